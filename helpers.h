@@ -10,36 +10,69 @@
 #define GerstnerOceanNode_helpers
 
 #include <complex>
+#include <cmath>
+#include <cstdint>
 
 /**
- * A function to compute a value with a random Gaussian distribution, mean 0, standard deviation 1.
- * Based on the Abramowitz and Stegun method; this is the code given in the comp.lang.c FAQ.
- * See <http://c-faq.com/lib/gaussian.html>.
+ * The Philox4x32-10 counter-based pseudorandom function (Salmon et al., "Parallel Random Numbers: As Easy as
+ * 1, 2, 3", SC 2011). Maps a 128-bit counter and a 64-bit key to 128 random bits, with no hidden state, so any
+ * number of values can be generated independently and in any order, from any thread.
  */
-static double random_gaussian()
+static void philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4])
 {
-    static double U, V;
-    static int phase = 0;
-    double Z;
+    const uint32_t M0 = 0xD2511F53, M1 = 0xCD9E8D57;    // Multipliers.
+    const uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85;    // Key schedule (Weyl sequence) increments.
     
-    if(phase == 0) {
-        U = (rand() + 1.) / (RAND_MAX + 2.);
-        V = rand() / (RAND_MAX + 1.);
-        Z = sqrt(-2 * log(U)) * sin(2 * M_PI * V);
-    } else
-        Z = sqrt(-2 * log(U)) * cos(2 * M_PI * V);
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
     
-    phase = 1 - phase;
+    for (int round = 0; round < 10; round++) {
+        uint64_t p0 = (uint64_t)M0 * c0;
+        uint64_t p1 = (uint64_t)M1 * c2;
+        uint32_t hi0 = (uint32_t)(p0 >> 32), lo0 = (uint32_t)p0;
+        uint32_t hi1 = (uint32_t)(p1 >> 32), lo1 = (uint32_t)p1;
+        
+        c0 = hi1 ^ c1 ^ k0;
+        c1 = lo1;
+        c2 = hi0 ^ c3 ^ k1;
+        c3 = lo0;
+        
+        k0 += W0;
+        k1 += W1;
+    }
     
-    return Z;
+    out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
 }
 
 /**
- * Gets a complex with the real and imaginary components calculated using a random Gaussian distribution.
+ * Converts 64 random bits to a double uniformly distributed in the half-open interval (0, 1].
  */
-static std::complex<double> random_gaussian_complex()
+static double uniform_open_closed(uint32_t hi, uint32_t lo)
 {
-    return std::complex<double>(random_gaussian(), random_gaussian());
+    uint64_t bits = ((uint64_t)hi << 32 | lo) >> 11;    // 53 significant bits.
+    return (bits + 1.) / 9007199254740992.;             // 2^53.
+}
+
+/**
+ * Gets a complex with the real and imaginary components drawn independently from a Gaussian distribution,
+ * mean 0, standard deviation 1, for the wavevector with integer coordinates (kx, kz).
+ *
+ * The value is a pure function of (seed, kx, kz): Philox provides two uniforms, which the Box-Muller transform
+ * turns into two Gaussians. It is therefore reentrant, can be evaluated in parallel, and a given wavevector keeps
+ * its value when the grid resolution changes.
+ */
+static std::complex<double> random_gaussian_complex(int seed, int kx, int kz)
+{
+    const uint32_t counter[4] = { (uint32_t)kx, (uint32_t)kz, 0, 0 };
+    const uint32_t key[2] = { (uint32_t)seed, 0x6F63656E }; // Second key word: "ocen".
+    uint32_t bits[4];
+    philox4x32(counter, key, bits);
+    
+    double U = uniform_open_closed(bits[0], bits[1]);
+    double V = uniform_open_closed(bits[2], bits[3]);
+    double R = sqrt(-2 * log(U));
+    
+    return std::complex<double>(R * cos(2 * M_PI * V), R * sin(2 * M_PI * V));
 }
 
 #endif
@@ -0,0 +1,43 @@
+//
+//  kissfft_avx2.cpp
+//  TessendorfOceanNode
+//
+//  The AVX2 lane kernel for single-precision batched FFTs. This file must be compiled with
+//  AVX2 and FMA code generation enabled (e.g. -mavx2 -mfma); it is only used after a run-time
+//  check that the CPU supports them. Without those flags it compiles to a stub.
+//
+
+#include "kissfft_lanes.hh"
+#include <cstddef>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+
+namespace {
+
+struct lanes_avx2 {
+    typedef __m256 type;
+    enum { width = 8 };
+    static type load(const float * p) { return _mm256_loadu_ps(p); }
+    static void store(float * p, type v) { _mm256_storeu_ps(p, v); }
+    static type set1(float f) { return _mm256_set1_ps(f); }
+    static type add(type a, type b) { return _mm256_add_ps(a, b); }
+    static type sub(type a, type b) { return _mm256_sub_ps(a, b); }
+    static type mul(type a, type b) { return _mm256_mul_ps(a, b); }
+};
+
+}
+
+kissfft_lanes_plan * kissfft_create_avx2_plan(int nfft, bool inverse, bool radix4)
+{
+    return kissfft_create_lanes<lanes_avx2>(nfft, inverse, radix4);
+}
+
+#else
+
+kissfft_lanes_plan * kissfft_create_avx2_plan(int, bool, bool)
+{
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,143 @@
+//
+//  kissfft_batch.hh
+//  TessendorfOceanNode
+//
+//  Runs many equal-length 1D FFTs laid out with arbitrary strides, as needed by the
+//  row and column passes of a 2D transform.
+//
+
+#ifndef KISSFFT_BATCH_HH
+#define KISSFFT_BATCH_HH
+
+#include "kissfft.hh"
+#include <algorithm>
+#include <complex>
+#include <vector>
+
+/**
+ * A batch of `count` in-place FFTs of length n. Element j of transform t is at data[t * dist + j * stride].
+ *
+ * The generic version gathers the whole batch into a contiguous tile (walking the elements in memory order),
+ * runs the scalar kissfft on each transform, and scatters the results back. transform() is const and may be
+ * called concurrently, as long as each caller passes its own scratch.
+ */
+template <typename T_Scalar>
+class kissfft_batch
+{
+    public:
+        typedef std::complex<T_Scalar> cpx_type;
+
+        kissfft_batch(int nfft, bool inverse)
+            :_nfft(nfft),_fft(nfft, inverse)
+        {
+        }
+
+        int nfft() const { return _nfft; }
+
+        /** The code that runs the transforms: always the C++ library code. */
+        const char * backend() const { return "kissfft"; }
+
+        /** Whether a kernel specialized for this length runs: never for the library code. */
+        bool fixedLength() const { return false; }
+
+        /** Number of complex elements of scratch space needed to transform `count` inputs at once. */
+        size_t scratchSize(int count) const { return (size_t)(count + 1) * _nfft; }
+
+        void transform(cpx_type * data, size_t stride, size_t dist, int count, cpx_type * scratch) const
+        {
+            cpx_type * tile = scratch;
+            cpx_type * out = scratch + (size_t)count * _nfft;
+
+            for (int j = 0; j < _nfft; ++j)
+                for (int t = 0; t < count; ++t)
+                    tile[(size_t)t * _nfft + j] = data[t * dist + j * stride];
+
+            for (int t = 0; t < count; ++t) {
+                cpx_type * in = tile + (size_t)t * _nfft;
+                _fft.transform(in, out);
+                std::copy(out, out + _nfft, in);
+            }
+
+            for (int j = 0; j < _nfft; ++j)
+                for (int t = 0; t < count; ++t)
+                    data[t * dist + j * stride] = tile[(size_t)t * _nfft + j];
+        }
+
+    private:
+        int _nfft;
+        mutable kissfft<T_Scalar> _fft; // kissfft::transform is non-const but doesn't modify the plan.
+};
+
+class kissfft_lanes_plan;
+
+/**
+ * Single-precision batches run several transforms at once, one per SIMD lane. The widest instruction set that
+ * the CPU supports (AVX2, then SSE2, then plain scalar code) is picked at run time when the plan is created.
+ *
+ * The code that runs the transforms is one of several backends:
+ *   "avx2", "sse2", "scalar"   the lane kernels, factored like kissfft (radix 4 first)
+ *   "avx2-radix2", ...         the lane kernels, factored with radix 2 instead of 4
+ *   "kiss_fft", "kissfft"      the C (kiss_fft.c) and C++ (kissfft.hh) library code, one transform at a time
+ * Without wisdom (see kissfft_wisdom) the widest lane kernel is used; with it, the fastest backend measured for
+ * the length. All backends compute the same transform, to within float rounding.
+ */
+template <>
+class kissfft_batch<float>
+{
+    public:
+        typedef std::complex<float> cpx_type;
+
+        kissfft_batch(int nfft, bool inverse);
+
+        /**
+         * Creates a plan with the given backend, falling back to the default one if the CPU can't run it.
+         */
+        kissfft_batch(int nfft, bool inverse, const char * backend);
+        ~kissfft_batch();
+
+        int nfft() const { return _nfft; }
+
+        /** Number of transforms computed together (the SIMD width). */
+        int lanes() const;
+
+        /** Name of the instruction set in use ("avx2", "sse2" or "scalar"). */
+        const char * isa() const { return _isa; }
+
+        /** Name of the backend in use. */
+        const char * backend() const { return _backend; }
+
+        /**
+         * Whether the backend runs a kernel specialized for this length: the lane kernels are, for the power-of-two
+         * lengths from 128 to 2048 (see kissfft_lanes_fixed).
+         */
+        bool fixedLength() const;
+
+        size_t scratchSize(int count) const;
+
+        void transform(cpx_type * data, size_t stride, size_t dist, int count, cpx_type * scratch) const;
+
+        /**
+         * Gets the backends that this build can run on this CPU, the default one first.
+         */
+        static std::vector<const char *> backends();
+
+        /**
+         * Forces a particular backend for plans created afterwards (see backends(); the instruction set names
+         * "avx2", "sse2" and "scalar" pick the lane kernels), or restores automatic selection when given NULL.
+         * Requests for backends the CPU can't run fall back automatically. Intended for testing and benchmarking.
+         */
+        static void forceBackend(const char * backend);
+
+    private:
+        kissfft_batch(const kissfft_batch &);
+        kissfft_batch & operator=(const kissfft_batch &);
+
+        void create(const char * backend, bool inverse);
+
+        int _nfft;
+        const char * _isa;
+        const char * _backend;
+        kissfft_lanes_plan * _plan;
+};
+
+#endif
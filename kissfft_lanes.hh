@@ -0,0 +1,411 @@
+//
+//  kissfft_lanes.hh
+//  TessendorfOceanNode
+//
+//  The kissfft mixed-radix algorithm rewritten to run several single-precision transforms
+//  at once, one per SIMD lane. Only included by the kissfft_simd*.cpp translation units,
+//  each of which instantiates it for the instruction set it is compiled for.
+//
+
+#ifndef KISSFFT_LANES_HH
+#define KISSFFT_LANES_HH
+
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+/**
+ * A single-precision FFT plan that transforms `width()` independent inputs at once.
+ *
+ * Buffers hold n elements in "lane-interleaved" order: element j of all transforms occupies 2 * width() floats
+ * starting at 2 * width() * j, first the real parts of every lane, then the imaginary parts.
+ *
+ * The twiddles and factorization are computed here, in code built for the baseline instruction set, and exposed
+ * to the kernels as raw arrays. Kernels built for wider instruction sets therefore share no inline library code
+ * (std::vector, std::complex) with the rest of the program, which could otherwise end up running the wide
+ * instructions on a CPU without them.
+ */
+class kissfft_lanes_plan
+{
+    public:
+        /**
+         * \param radix4 whether to factor out 4's before 2's, like kissfft, or only 2's (then 3, 5, 7, ...)
+         */
+        kissfft_lanes_plan(int nfft, bool inverse, bool radix4 = true);
+        virtual ~kissfft_lanes_plan();
+
+        /** Number of transforms computed per call. */
+        virtual int width() const = 0;
+
+        /** Whether the kernel is specialized for its length (see kissfft_lanes_fixed). */
+        virtual bool fixedLength() const { return false; }
+
+        /** Transforms the lanes of `src` into `dst`; the buffers must not overlap. */
+        virtual void transform(const float * src, float * dst) const = 0;
+
+    protected:
+        int _nfft;
+        bool _inverse;
+        int _stages;
+        const float * _tw;          /* Twiddles, interleaved (re, im). */
+        const int * _radix;         /* Radix of each stage. */
+        const int * _remainder;     /* Remaining length after each stage. */
+
+    private:
+        kissfft_lanes_plan(const kissfft_lanes_plan &);
+        kissfft_lanes_plan & operator=(const kissfft_lanes_plan &);
+
+        std::vector<float> _twiddleStorage;
+        std::vector<int> _factorStorage;
+};
+
+/**
+ * The kissfft algorithm (radix 4, 2, 3, 5, then generic stages) over lane vectors.
+ *
+ * T_Lanes describes one instruction set: a vector type holding `width` floats, with load, store, set1, add, sub
+ * and mul. Twiddles are the same for every lane, so they are broadcast from the scalar table. Translation units
+ * built for wider instruction sets should define their T_Lanes in an anonymous namespace so that the
+ * instantiation stays local to them.
+ */
+template <typename T_Lanes>
+class kissfft_lanes : public kissfft_lanes_plan
+{
+    public:
+        typedef typename T_Lanes::type vec;
+        enum { W = T_Lanes::width, E = 2 * T_Lanes::width }; // E: floats per lane-interleaved element.
+
+        kissfft_lanes(int nfft, bool inverse, bool radix4)
+            :kissfft_lanes_plan(nfft, inverse, radix4)
+        {
+        }
+
+        int width() const { return W; }
+
+        void transform(const float * src, float * dst) const
+        {
+            kf_work(0, dst, src, 1);
+        }
+
+    protected:
+        struct cpx { vec r, i; };
+
+        static cpx load(const float * p) { cpx c; c.r = T_Lanes::load(p); c.i = T_Lanes::load(p + W); return c; }
+        static void store(float * p, const cpx & c) { T_Lanes::store(p, c.r); T_Lanes::store(p + W, c.i); }
+
+        static cpx add(const cpx & a, const cpx & b) { cpx c; c.r = T_Lanes::add(a.r, b.r); c.i = T_Lanes::add(a.i, b.i); return c; }
+        static cpx sub(const cpx & a, const cpx & b) { cpx c; c.r = T_Lanes::sub(a.r, b.r); c.i = T_Lanes::sub(a.i, b.i); return c; }
+        static cpx scale(const cpx & a, vec s) { cpx c; c.r = T_Lanes::mul(a.r, s); c.i = T_Lanes::mul(a.i, s); return c; }
+
+        /** Multiplies every lane by twiddle i. */
+        cpx mul(const cpx & a, size_t i) const
+        {
+            vec wr = T_Lanes::set1(_tw[2 * i]);
+            vec wi = T_Lanes::set1(_tw[2 * i + 1]);
+            cpx c;
+            c.r = T_Lanes::sub(T_Lanes::mul(a.r, wr), T_Lanes::mul(a.i, wi));
+            c.i = T_Lanes::add(T_Lanes::mul(a.r, wi), T_Lanes::mul(a.i, wr));
+            return c;
+        }
+
+        /** Multiplies by -i (forward) or +i (inverse). */
+        cpx rotate(const cpx & a) const
+        {
+            cpx c;
+            if (_inverse) {
+                c.r = T_Lanes::sub(T_Lanes::set1(0.f), a.i);
+                c.i = a.r;
+            } else {
+                c.r = a.i;
+                c.i = T_Lanes::sub(T_Lanes::set1(0.f), a.r);
+            }
+            return c;
+        }
+
+    private:
+        void kf_work(int stage, float * Fout, const float * f, size_t fstride) const
+        {
+            int p = _radix[stage];
+            int m = _remainder[stage];
+            float * Fout_beg = Fout;
+            float * Fout_end = Fout + (size_t)p * m * E;
+
+            if (m == 1) {
+                do {
+                    for (int e = 0; e < E; ++e)
+                        Fout[e] = f[e];
+                    f += fstride * E;
+                } while ((Fout += E) != Fout_end);
+            } else {
+                do {
+                    kf_work(stage + 1, Fout, f, fstride * p);
+                    f += fstride * E;
+                } while ((Fout += (size_t)m * E) != Fout_end);
+            }
+
+            switch (p) {
+                case 2: kf_bfly2(Fout_beg, fstride, m); break;
+                case 3: kf_bfly3(Fout_beg, fstride, m); break;
+                case 4: kf_bfly4(Fout_beg, fstride, m); break;
+                case 5: kf_bfly5(Fout_beg, fstride, m); break;
+                default: kf_bfly_generic(Fout_beg, fstride, m, p); break;
+            }
+        }
+
+        void kf_bfly2(float * Fout, size_t fstride, int m) const
+        {
+            for (int k = 0; k < m; ++k) {
+                cpx a = load(Fout + (size_t)k * E);
+                cpx t = mul(load(Fout + (size_t)(m + k) * E), k * fstride);
+                store(Fout + (size_t)(m + k) * E, sub(a, t));
+                store(Fout + (size_t)k * E, add(a, t));
+            }
+        }
+
+        void kf_bfly4(float * Fout, size_t fstride, int m) const
+        {
+            for (int k = 0; k < m; ++k) {
+                float * F0 = Fout + (size_t)k * E;
+                float * F1 = F0 + (size_t)m * E;
+                float * F2 = F1 + (size_t)m * E;
+                float * F3 = F2 + (size_t)m * E;
+
+                cpx s0 = mul(load(F1), k * fstride);
+                cpx s1 = mul(load(F2), k * fstride * 2);
+                cpx s2 = mul(load(F3), k * fstride * 3);
+                cpx f0 = load(F0);
+
+                cpx s5 = sub(f0, s1);
+                f0 = add(f0, s1);
+                cpx s3 = add(s0, s2);
+                cpx s4 = rotate(sub(s0, s2));
+
+                store(F2, sub(f0, s3));
+                store(F0, add(f0, s3));
+                store(F1, add(s5, s4));
+                store(F3, sub(s5, s4));
+            }
+        }
+
+        void kf_bfly3(float * Fout, size_t fstride, int m) const
+        {
+            vec half = T_Lanes::set1(0.5f);
+            vec epi3i = T_Lanes::set1(_tw[2 * fstride * m + 1]);
+
+            for (int k = 0; k < m; ++k) {
+                float * F0 = Fout + (size_t)k * E;
+                float * F1 = F0 + (size_t)m * E;
+                float * F2 = F1 + (size_t)m * E;
+
+                cpx s1 = mul(load(F1), k * fstride);
+                cpx s2 = mul(load(F2), k * fstride * 2);
+                cpx s3 = add(s1, s2);
+                cpx s0 = scale(sub(s1, s2), epi3i);
+                cpx f0 = load(F0);
+
+                cpx f1 = sub(f0, scale(s3, half));
+                f0 = add(f0, s3);
+
+                cpx f2;
+                f2.r = T_Lanes::add(f1.r, s0.i);
+                f2.i = T_Lanes::sub(f1.i, s0.r);
+                f1.r = T_Lanes::sub(f1.r, s0.i);
+                f1.i = T_Lanes::add(f1.i, s0.r);
+
+                store(F0, f0);
+                store(F1, f1);
+                store(F2, f2);
+            }
+        }
+
+        void kf_bfly5(float * Fout, size_t fstride, int m) const
+        {
+            vec yar = T_Lanes::set1(_tw[2 * fstride * m]), yai = T_Lanes::set1(_tw[2 * fstride * m + 1]);
+            vec ybr = T_Lanes::set1(_tw[4 * fstride * m]), ybi = T_Lanes::set1(_tw[4 * fstride * m + 1]);
+
+            for (int u = 0; u < m; ++u) {
+                float * F0 = Fout + (size_t)u * E;
+                float * F1 = F0 + (size_t)m * E;
+                float * F2 = F1 + (size_t)m * E;
+                float * F3 = F2 + (size_t)m * E;
+                float * F4 = F3 + (size_t)m * E;
+
+                cpx s0 = load(F0);
+                cpx s1 = mul(load(F1), u * fstride);
+                cpx s2 = mul(load(F2), 2 * u * fstride);
+                cpx s3 = mul(load(F3), 3 * u * fstride);
+                cpx s4 = mul(load(F4), 4 * u * fstride);
+
+                cpx s7 = add(s1, s4);
+                cpx s10 = sub(s1, s4);
+                cpx s8 = add(s2, s3);
+                cpx s9 = sub(s2, s3);
+
+                store(F0, add(s0, add(s7, s8)));
+
+                cpx s5, s6, s11, s12;
+                s5.r = T_Lanes::add(s0.r, T_Lanes::add(T_Lanes::mul(s7.r, yar), T_Lanes::mul(s8.r, ybr)));
+                s5.i = T_Lanes::add(s0.i, T_Lanes::add(T_Lanes::mul(s7.i, yar), T_Lanes::mul(s8.i, ybr)));
+                s6.r = T_Lanes::add(T_Lanes::mul(s10.i, yai), T_Lanes::mul(s9.i, ybi));
+                s6.i = T_Lanes::sub(T_Lanes::sub(T_Lanes::set1(0.f), T_Lanes::mul(s10.r, yai)), T_Lanes::mul(s9.r, ybi));
+
+                store(F1, sub(s5, s6));
+                store(F4, add(s5, s6));
+
+                s11.r = T_Lanes::add(s0.r, T_Lanes::add(T_Lanes::mul(s7.r, ybr), T_Lanes::mul(s8.r, yar)));
+                s11.i = T_Lanes::add(s0.i, T_Lanes::add(T_Lanes::mul(s7.i, ybr), T_Lanes::mul(s8.i, yar)));
+                s12.r = T_Lanes::sub(T_Lanes::mul(s9.i, yai), T_Lanes::mul(s10.i, ybi));
+                s12.i = T_Lanes::sub(T_Lanes::mul(s10.r, ybi), T_Lanes::mul(s9.r, yai));
+
+                store(F2, add(s11, s12));
+                store(F3, sub(s11, s12));
+            }
+        }
+
+        void kf_bfly_generic(float * Fout, size_t fstride, int m, int p) const
+        {
+            float * scratch = new float[(size_t)p * E]; // Plain floats: vectors may need more alignment than new gives.
+
+            for (int u = 0; u < m; ++u) {
+                int k = u;
+                for (int q1 = 0; q1 < p; ++q1) {
+                    store(scratch + (size_t)q1 * E, load(Fout + (size_t)k * E));
+                    k += m;
+                }
+
+                k = u;
+                for (int q1 = 0; q1 < p; ++q1) {
+                    size_t twidx = 0;
+                    cpx acc = load(scratch);
+                    for (int q = 1; q < p; ++q) {
+                        twidx += fstride * k;
+                        if (twidx >= (size_t)_nfft) twidx -= _nfft;
+                        acc = add(acc, mul(load(scratch + (size_t)q * E), twidx));
+                    }
+                    store(Fout + (size_t)k * E, acc);
+                    k += m;
+                }
+            }
+
+            delete [] scratch;
+        }
+};
+
+/**
+ * The kissfft_lanes algorithm specialized for one power-of-two length N, for the grid resolutions in common use.
+ *
+ * The factorization (radix 4, then a final radix 2 if N is an odd power of two) is resolved at compile time, so
+ * each stage is a separate function with fixed loop bounds and twiddle strides, and the recursion over the
+ * sub-transforms unrolls. The operations and twiddles are those of the generic kernel, so the results are the
+ * same. The twiddles stay in the plan's table: they are computed once per plan in double precision, as C++11
+ * can't evaluate the trigonometric functions at compile time.
+ */
+template <typename T_Lanes, int N>
+class kissfft_lanes_fixed : public kissfft_lanes<T_Lanes>
+{
+    public:
+        typedef kissfft_lanes<T_Lanes> base;
+        typedef typename base::cpx cpx;
+        enum { E = base::E };
+
+        explicit kissfft_lanes_fixed(bool inverse)
+            :base(N, inverse, true)
+        {
+        }
+
+        bool fixedLength() const { return true; }
+
+        void transform(const float * src, float * dst) const
+        {
+            work<N, 1>(dst, src);
+        }
+
+    private:
+        /**
+         * Transforms the sub-sequence of Length = N / Fstride elements of `f` (every Fstride'th element) into
+         * Fout: Radix sub-transforms of Length / Radix, then one butterfly pass.
+         */
+        template <int Length, int Fstride>
+        void work(float * Fout, const float * f) const
+        {
+            enum { Radix = Length % 4 == 0 ? 4 : 2, M = Length / Radix };
+            split<Radix, M, Fstride>(Fout, f, std::integral_constant<bool, M == 1>());
+            butterfly<M, Fstride>(Fout, std::integral_constant<int, Radix>());
+        }
+
+        /** The sub-transforms of length 1: copies. */
+        template <int Radix, int M, int Fstride>
+        void split(float * Fout, const float * f, std::true_type) const
+        {
+            for (int q = 0; q < Radix; ++q)
+                for (int e = 0; e < E; ++e)
+                    Fout[(size_t)q * E + e] = f[(size_t)q * Fstride * E + e];
+        }
+
+        template <int Radix, int M, int Fstride>
+        void split(float * Fout, const float * f, std::false_type) const
+        {
+            for (int q = 0; q < Radix; ++q)
+                work<M, Fstride * Radix>(Fout + (size_t)q * M * E, f + (size_t)q * Fstride * E);
+        }
+
+        template <int M, int Fstride>
+        void butterfly(float * Fout, std::integral_constant<int, 2>) const
+        {
+            for (int k = 0; k < M; ++k) {
+                cpx a = base::load(Fout + (size_t)k * E);
+                cpx t = this->mul(base::load(Fout + (size_t)(M + k) * E), (size_t)k * Fstride);
+                base::store(Fout + (size_t)(M + k) * E, base::sub(a, t));
+                base::store(Fout + (size_t)k * E, base::add(a, t));
+            }
+        }
+
+        template <int M, int Fstride>
+        void butterfly(float * Fout, std::integral_constant<int, 4>) const
+        {
+            for (int k = 0; k < M; ++k) {
+                float * F0 = Fout + (size_t)k * E;
+                float * F1 = F0 + (size_t)M * E;
+                float * F2 = F1 + (size_t)M * E;
+                float * F3 = F2 + (size_t)M * E;
+
+                cpx s0 = this->mul(base::load(F1), (size_t)k * Fstride);
+                cpx s1 = this->mul(base::load(F2), (size_t)k * Fstride * 2);
+                cpx s2 = this->mul(base::load(F3), (size_t)k * Fstride * 3);
+                cpx f0 = base::load(F0);
+
+                cpx s5 = base::sub(f0, s1);
+                f0 = base::add(f0, s1);
+                cpx s3 = base::add(s0, s2);
+                cpx s4 = this->rotate(base::sub(s0, s2));
+
+                base::store(F2, base::sub(f0, s3));
+                base::store(F0, base::add(f0, s3));
+                base::store(F1, base::add(s5, s4));
+                base::store(F3, base::sub(s5, s4));
+            }
+        }
+};
+
+/**
+ * Creates a lane kernel for transforms of length nfft: the one specialized for the length if there is one (the
+ * row and column lengths of the 256 x 256 to 2048 x 2048 grids) and radix4 is set, otherwise the generic one.
+ * Define KISSFFT_NO_FIXED_LENGTHS to always use the generic kernel, e.g. to compare the two.
+ */
+template <typename T_Lanes>
+kissfft_lanes_plan * kissfft_create_lanes(int nfft, bool inverse, bool radix4)
+{
+#ifndef KISSFFT_NO_FIXED_LENGTHS
+    if (radix4) {
+        switch (nfft) {
+            case 128:   return new kissfft_lanes_fixed<T_Lanes, 128>(inverse);
+            case 256:   return new kissfft_lanes_fixed<T_Lanes, 256>(inverse);
+            case 512:   return new kissfft_lanes_fixed<T_Lanes, 512>(inverse);
+            case 1024:  return new kissfft_lanes_fixed<T_Lanes, 1024>(inverse);
+            case 2048:  return new kissfft_lanes_fixed<T_Lanes, 2048>(inverse);
+        }
+    }
+#endif
+    return new kissfft_lanes<T_Lanes>(nfft, inverse, radix4);
+}
+
+#endif
@@ -0,0 +1,294 @@
+//
+//  kissfft_simd.cpp
+//  TessendorfOceanNode
+//
+//  Single-precision batched FFTs: the scalar and SSE2 lane kernels, the kiss_fft and kissfft
+//  library code behind the same plan interface, and run-time selection of the backend. The
+//  AVX2 kernel lives in kissfft_avx2.cpp, which is compiled with AVX2 code generation enabled.
+//
+
+#include "kissfft_batch.hh"
+#include "kissfft_lanes.hh"
+#include "kissfft_wisdom.hh"
+#include "kiss_fft.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#define KISSFFT_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+/** Creates an AVX2 plan, or returns NULL if AVX2 support wasn't compiled in (see kissfft_avx2.cpp). */
+kissfft_lanes_plan * kissfft_create_avx2_plan(int nfft, bool inverse, bool radix4);
+
+/** Whether the CPU running this process supports AVX2 and FMA. */
+static bool cpu_has_avx2()
+{
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+    return false;
+#endif
+}
+
+struct lanes_scalar {
+    typedef float type;
+    enum { width = 1 };
+    static type load(const float * p) { return *p; }
+    static void store(float * p, type v) { *p = v; }
+    static type set1(float f) { return f; }
+    static type add(type a, type b) { return a + b; }
+    static type sub(type a, type b) { return a - b; }
+    static type mul(type a, type b) { return a * b; }
+};
+
+#ifdef KISSFFT_HAVE_SSE2
+struct lanes_sse2 {
+    typedef __m128 type;
+    enum { width = 4 };
+    static type load(const float * p) { return _mm_loadu_ps(p); }
+    static void store(float * p, type v) { _mm_storeu_ps(p, v); }
+    static type set1(float f) { return _mm_set1_ps(f); }
+    static type add(type a, type b) { return _mm_add_ps(a, b); }
+    static type sub(type a, type b) { return _mm_sub_ps(a, b); }
+    static type mul(type a, type b) { return _mm_mul_ps(a, b); }
+};
+#endif
+
+kissfft_lanes_plan::kissfft_lanes_plan(int nfft, bool inverse, bool radix4)
+    :_nfft(nfft),_inverse(inverse)
+{
+    // Twiddles are computed in double precision and then rounded, which keeps float errors to the butterflies.
+    _twiddleStorage.resize(2 * nfft);
+    double phinc = (inverse ? 2 : -2) * acos(-1.) / nfft;
+    for (int i = 0; i < nfft; ++i) {
+        _twiddleStorage[2 * i] = (float)cos(i * phinc);
+        _twiddleStorage[2 * i + 1] = (float)sin(i * phinc);
+    }
+
+    // Same factorization as kissfft: 4's, then 2's, then 3, 5, 7, ... (or without the 4's).
+    std::vector<int> radix, remainder;
+    int n = nfft;
+    int p = radix4 ? 4 : 2;
+    do {
+        while (n % p) {
+            switch (p) {
+                case 4: p = 2; break;
+                case 2: p = 3; break;
+                default: p += 2; break;
+            }
+            if (p*p > n)
+                p = n;
+        }
+        n /= p;
+        radix.push_back(p);
+        remainder.push_back(n);
+    } while (n > 1);
+
+    _stages = (int)radix.size();
+    _factorStorage = radix;
+    _factorStorage.insert(_factorStorage.end(), remainder.begin(), remainder.end());
+
+    _tw = &_twiddleStorage[0];
+    _radix = &_factorStorage[0];
+    _remainder = &_factorStorage[_stages];
+}
+
+kissfft_lanes_plan::~kissfft_lanes_plan()
+{
+}
+
+/**
+ * The C kiss_fft library code as a plan of width 1, whose lane-interleaved layout is kiss_fft_cpx's.
+ */
+class kissfft_c_plan : public kissfft_lanes_plan
+{
+    public:
+        kissfft_c_plan(int nfft, bool inverse)
+            :kissfft_lanes_plan(nfft, inverse),_cfg(kiss_fft_alloc(nfft, inverse, NULL, NULL))
+        {
+        }
+
+        ~kissfft_c_plan() { free(_cfg); }
+
+        int width() const { return 1; }
+
+        void transform(const float * src, float * dst) const
+        {
+            kiss_fft(_cfg, reinterpret_cast<const kiss_fft_cpx *>(src), reinterpret_cast<kiss_fft_cpx *>(dst));
+        }
+
+    private:
+        kiss_fft_cfg _cfg;
+};
+
+/**
+ * The C++ kissfft library code as a plan of width 1, whose lane-interleaved layout is std::complex<float>'s.
+ */
+class kissfft_cpp_plan : public kissfft_lanes_plan
+{
+    public:
+        kissfft_cpp_plan(int nfft, bool inverse)
+            :kissfft_lanes_plan(nfft, inverse),_fft(nfft, inverse)
+        {
+        }
+
+        int width() const { return 1; }
+
+        void transform(const float * src, float * dst) const
+        {
+            typedef std::complex<float> cpx;
+            _fft.transform(reinterpret_cast<const cpx *>(src), reinterpret_cast<cpx *>(dst));
+        }
+
+    private:
+        mutable kissfft<float> _fft; // kissfft::transform is non-const but doesn't modify the plan.
+};
+
+/** The backends, in order of preference without wisdom. */
+static const char * const backendNames[] = {
+    "avx2", "sse2", "scalar", "avx2-radix2", "sse2-radix2", "scalar-radix2", "kiss_fft", "kissfft"
+};
+
+/**
+ * Creates the plan of the named backend, or returns NULL if the name is unknown or the build or the CPU can't
+ * run it. Sets `isa` and `backend` to static names.
+ */
+static kissfft_lanes_plan * create_plan(const char * name, int nfft, bool inverse, const char ** isa, const char ** backend)
+{
+    const char * const * known = std::find_if(backendNames, backendNames + sizeof(backendNames) / sizeof(backendNames[0]),
+                                              [name](const char * b) { return strcmp(b, name) == 0; });
+    if (known == backendNames + sizeof(backendNames) / sizeof(backendNames[0])) {
+        return NULL;
+    }
+    *backend = *known;
+    *isa = "scalar";
+
+    bool radix4 = strstr(name, "-radix2") == NULL;
+    if (strncmp(name, "avx2", 4) == 0) {
+        *isa = "avx2";
+        return cpu_has_avx2() ? kissfft_create_avx2_plan(nfft, inverse, radix4) : NULL;
+    }
+    if (strncmp(name, "sse2", 4) == 0) {
+        *isa = "sse2";
+#ifdef KISSFFT_HAVE_SSE2
+        return kissfft_create_lanes<lanes_sse2>(nfft, inverse, radix4);
+#else
+        return NULL;
+#endif
+    }
+    if (strncmp(name, "scalar", 6) == 0) {
+        return kissfft_create_lanes<lanes_scalar>(nfft, inverse, radix4);
+    }
+    if (strcmp(name, "kiss_fft") == 0) {
+        return new kissfft_c_plan(nfft, inverse);
+    }
+    return new kissfft_cpp_plan(nfft, inverse);
+}
+
+static const char * forcedBackend = NULL;
+
+void kissfft_batch<float>::forceBackend(const char * backend)
+{
+    forcedBackend = backend;
+}
+
+std::vector<const char *> kissfft_batch<float>::backends()
+{
+    std::vector<const char *> result;
+    for (size_t i = 0; i < sizeof(backendNames) / sizeof(backendNames[0]); ++i) {
+        const char * isa;
+        const char * backend;
+        kissfft_lanes_plan * plan = create_plan(backendNames[i], 4, true, &isa, &backend);
+        if (plan) {
+            result.push_back(backendNames[i]);
+            delete plan;
+        }
+    }
+    return result;
+}
+
+kissfft_batch<float>::kissfft_batch(int nfft, bool inverse)
+    :_nfft(nfft),_isa("scalar"),_backend("scalar"),_plan(NULL)
+{
+    // Forced backends come first, then the wisdom (which may time the backends now, on first use of the length).
+    create(forcedBackend ? forcedBackend : kissfft_wisdom::best(nfft, inverse), inverse);
+}
+
+kissfft_batch<float>::kissfft_batch(int nfft, bool inverse, const char * backend)
+    :_nfft(nfft),_isa("scalar"),_backend("scalar"),_plan(NULL)
+{
+    create(backend, inverse);
+}
+
+void kissfft_batch<float>::create(const char * backend, bool inverse)
+{
+    if (backend) {
+        _plan = create_plan(backend, _nfft, inverse, &_isa, &_backend);
+    }
+    
+    // Otherwise the widest lane kernel the CPU supports.
+    for (int i = 0; !_plan; ++i) {
+        _plan = create_plan(backendNames[i], _nfft, inverse, &_isa, &_backend);
+    }
+}
+
+kissfft_batch<float>::~kissfft_batch()
+{
+    delete _plan;
+}
+
+int kissfft_batch<float>::lanes() const
+{
+    return _plan->width();
+}
+
+bool kissfft_batch<float>::fixedLength() const
+{
+    return _plan->fixedLength();
+}
+
+size_t kissfft_batch<float>::scratchSize(int) const
+{
+    // Two lane-interleaved buffers (input and output) of nfft elements, each element one complex per lane.
+    return 2 * (size_t)_nfft * _plan->width();
+}
+
+void kissfft_batch<float>::transform(cpx_type * data, size_t stride, size_t dist, int count, cpx_type * scratch) const
+{
+    const int W = _plan->width();
+    const size_t E = 2 * W;
+    float * in = reinterpret_cast<float *>(scratch);
+    float * out = in + E * _nfft;
+
+    for (int t0 = 0; t0 < count; t0 += W) {
+        int lanes = std::min(W, count - t0);
+        cpx_type * base = data + t0 * dist;
+
+        // Gather up to W transforms; unused lanes are zeroed and ignored.
+        for (int j = 0; j < _nfft; ++j) {
+            float * e = in + E * j;
+            const cpx_type * src = base + j * stride;
+            int t = 0;
+            for (; t < lanes; ++t) {
+                e[t] = src[t * dist].real();
+                e[W + t] = src[t * dist].imag();
+            }
+            for (; t < W; ++t) {
+                e[t] = e[W + t] = 0.f;
+            }
+        }
+
+        _plan->transform(in, out);
+
+        for (int j = 0; j < _nfft; ++j) {
+            const float * e = out + E * j;
+            cpx_type * dst = base + j * stride;
+            for (int t = 0; t < lanes; ++t)
+                dst[t * dist] = cpx_type(e[t], e[W + t]);
+        }
+    }
+}
@@ -0,0 +1,294 @@
+//
+//  kissfft_wisdom.cpp
+//  TessendorfOceanNode
+//
+
+#include "kissfft_wisdom.hh"
+#include "kissfft_batch.hh"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <process.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#define TUNE_BATCH      16      // Transforms per timed batch, as in a column batch.
+#define TUNE_MIN_MS     0.25    // Each measurement repeats the batch for at least this long...
+#define TUNE_TRIALS     3       // ...and the fastest of this many measurements counts.
+
+/**
+ * The result of tuning one transform length.
+ */
+struct wisdom_entry {
+    const char *    backend;    /* Name of the fastest backend (one of kissfft_batch<float>::backends()). */
+    double          ns;         /* Its time per transform (in ns). */
+};
+
+typedef std::map<std::pair<int, bool>, wisdom_entry> wisdom_map;
+
+/**
+ * One line of the wisdom file, whose backend may be one this CPU can't run.
+ */
+struct wisdom_record {
+    int             nfft;
+    bool            inverse;
+    std::string     backend;
+    double          ns;
+};
+
+static std::mutex & lock()
+{
+    static std::mutex m;
+    return m;
+}
+
+static bool tuning = false;
+static std::string wisdomPath;
+static wisdom_map & wisdom()
+{
+    static wisdom_map w;
+    return w;
+}
+
+/**
+ * Times a batch of transforms of length nfft with the given backend.
+ * \return the time per transform (in ns), or a negative value if the CPU can't run the backend
+ */
+static double time_backend(const char * backend, int nfft, bool inverse)
+{
+    typedef std::chrono::steady_clock clock;
+    typedef kissfft_batch<float>::cpx_type cpx;
+
+    kissfft_batch<float> fft(nfft, inverse, backend);
+    if (strcmp(fft.backend(), backend) != 0) {
+        return -1.;
+    }
+
+    // Laid out like the columns of a grid, which is the harder access pattern. The input is restored before each
+    // batch so that repeated transforms don't overflow.
+    std::vector<cpx> input((size_t)nfft * TUNE_BATCH);
+    for (size_t i = 0; i < input.size(); ++i) {
+        input[i] = cpx((float)((i * 7919) % 1000) / 1000.f - .5f, (float)((i * 104729) % 1000) / 1000.f - .5f);
+    }
+    std::vector<cpx> data(input);
+    std::vector<cpx> scratch(fft.scratchSize(TUNE_BATCH));
+    fft.transform(&data[0], TUNE_BATCH, 1, TUNE_BATCH, &scratch[0]); // Warm up.
+
+    double best = -1.;
+    for (int trial = 0; trial < TUNE_TRIALS; ++trial) {
+        int batches = 0;
+        double ms = 0.;
+        clock::time_point start = clock::now();
+        do {
+            std::copy(input.begin(), input.end(), data.begin());
+            fft.transform(&data[0], TUNE_BATCH, 1, TUNE_BATCH, &scratch[0]);
+            batches++;
+            ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+        } while (ms < TUNE_MIN_MS);
+
+        double ns = ms * 1e6 / ((double)batches * TUNE_BATCH);
+        if (best < 0. || ns < best) {
+            best = ns;
+        }
+    }
+    return best;
+}
+
+/**
+ * Finds the static name of a backend among those this CPU can run.
+ * \return the name from `backends`, or NULL if the CPU can't run the backend
+ */
+static const char * runnable(const std::vector<const char *> & backends, const std::string & name)
+{
+    for (size_t b = 0; b < backends.size(); ++b) {
+        if (name == backends[b]) {
+            return backends[b];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Reads every entry of a wisdom file (none if it doesn't exist).
+ */
+static std::vector<wisdom_record> read_wisdom(const std::string & path)
+{
+    std::vector<wisdom_record> records;
+    FILE* file = path.empty() ? NULL : fopen(path.c_str(), "r");
+    if (!file) {
+        return records;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        int nfft, inverse;
+        char name[64];
+        double ns;
+        if (line[0] == '#' || sscanf(line, "%d %d %63s %lf", &nfft, &inverse, name, &ns) != 4 || nfft < 1) {
+            continue;
+        }
+        wisdom_record record = { nfft, inverse != 0, name, ns };
+        records.push_back(record);
+    }
+    fclose(file);
+    return records;
+}
+
+/**
+ * Moves a file over another in one step, so that readers see either the old or the new file.
+ */
+static bool replace_file(const std::string & from, const std::string & to)
+{
+#ifdef _WIN32
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0; // rename() won't overwrite.
+#else
+    return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+/**
+ * Writes the wisdom to the wisdom file, if there is one. Called with the lock held.
+ *
+ * The file may be shared by other sessions and other machines, so the entries it holds for backends this CPU can't
+ * run, and for lengths this session hasn't tuned, are kept. The file is written under a temporary name and then
+ * moved over the old one, so it is never seen half written.
+ */
+static void save()
+{
+    if (wisdomPath.empty()) {
+        return;
+    }
+
+    std::vector<const char *> backends = kissfft_batch<float>::backends();
+    std::vector<wisdom_record> kept;
+    std::vector<wisdom_record> records = read_wisdom(wisdomPath);
+    for (size_t r = 0; r < records.size(); ++r) {
+        const wisdom_record & record = records[r];
+        if (runnable(backends, record.backend) && wisdom().count(std::make_pair(record.nfft, record.inverse))) {
+            continue; // Tuned by this session.
+        }
+        bool duplicate = false;
+        for (size_t k = 0; k < kept.size() && !duplicate; ++k) {
+            duplicate = kept[k].nfft == record.nfft && kept[k].inverse == record.inverse && kept[k].backend == record.backend;
+        }
+        if (!duplicate) {
+            kept.push_back(record);
+        }
+    }
+
+#ifdef _WIN32
+    std::string tempPath = wisdomPath + "." + std::to_string(_getpid()) + ".tmp";
+#else
+    std::string tempPath = wisdomPath + "." + std::to_string(getpid()) + ".tmp";
+#endif
+    FILE* file = fopen(tempPath.c_str(), "w");
+    if (!file) {
+        return;
+    }
+    fprintf(file, "# kissfft wisdom: transform length, inverse, fastest backend, ns per transform\n");
+    for (wisdom_map::const_iterator it = wisdom().begin(); it != wisdom().end(); ++it) {
+        fprintf(file, "%d %d %s %.1f\n", it->first.first, it->first.second ? 1 : 0, it->second.backend, it->second.ns);
+    }
+    for (size_t k = 0; k < kept.size(); ++k) {
+        fprintf(file, "%d %d %s %.1f\n", kept[k].nfft, kept[k].inverse ? 1 : 0, kept[k].backend.c_str(), kept[k].ns);
+    }
+    bool ok = !ferror(file);
+    ok = fclose(file) == 0 && ok;
+
+    if (!ok || !replace_file(tempPath, wisdomPath)) {
+        remove(tempPath.c_str());
+    }
+}
+
+void kissfft_wisdom::enable(const std::string & path)
+{
+    std::lock_guard<std::mutex> guard(lock());
+    tuning = true;
+    wisdomPath = path;
+    wisdom().clear();
+
+    // Only backends this CPU can run are used (the others stay in the file for the machines that wrote them); the
+    // names are matched to the static ones. If machines with the same backends left several entries for a length,
+    // the fastest is used.
+    std::vector<const char *> backends = kissfft_batch<float>::backends();
+    std::vector<wisdom_record> records = read_wisdom(path);
+    for (size_t r = 0; r < records.size(); ++r) {
+        const char * backend = runnable(backends, records[r].backend);
+        std::pair<int, bool> key(records[r].nfft, records[r].inverse);
+        wisdom_map::const_iterator found = wisdom().find(key);
+        if (backend && (found == wisdom().end() || records[r].ns < found->second.ns)) {
+            wisdom_entry entry = { backend, records[r].ns };
+            wisdom()[key] = entry;
+        }
+    }
+}
+
+void kissfft_wisdom::disable()
+{
+    std::lock_guard<std::mutex> guard(lock());
+    tuning = false;
+    wisdomPath.clear();
+    wisdom().clear();
+}
+
+bool kissfft_wisdom::enabled()
+{
+    std::lock_guard<std::mutex> guard(lock());
+    return tuning;
+}
+
+const char * kissfft_wisdom::best(int nfft, bool inverse)
+{
+    std::lock_guard<std::mutex> guard(lock());
+    if (!tuning) {
+        return NULL;
+    }
+
+    std::pair<int, bool> key(nfft, inverse);
+    wisdom_map::const_iterator found = wisdom().find(key);
+    if (found != wisdom().end()) {
+        return found->second.backend;
+    }
+
+    // Tuning holds the lock, so a length is only ever tuned once, and tunings don't disturb each other's timing.
+    wisdom_entry entry = { NULL, 0. };
+    std::vector<const char *> backends = kissfft_batch<float>::backends();
+    for (size_t b = 0; b < backends.size(); ++b) {
+        double ns = time_backend(backends[b], nfft, inverse);
+        if (ns >= 0. && (!entry.backend || ns < entry.ns)) {
+            entry.backend = backends[b];
+            entry.ns = ns;
+        }
+    }
+
+    wisdom()[key] = entry;
+    save();
+    return entry.backend;
+}
+
+std::string kissfft_wisdom::defaultPath()
+{
+    const char * path = getenv("TESSENDORF_FFT_WISDOM");
+    if (path && *path) {
+        return path;
+    }
+#ifdef _WIN32
+    const char * home = getenv("USERPROFILE");
+#else
+    const char * home = getenv("HOME");
+#endif
+    return std::string(home ? home : ".") + "/.tessendorfOcean.wisdom";
+}
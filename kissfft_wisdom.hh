@@ -0,0 +1,56 @@
+//
+//  kissfft_wisdom.hh
+//  TessendorfOceanNode
+//
+//  Autotuning of the single-precision FFT backends: the fastest backend for each transform
+//  length, measured on first use and kept in a wisdom file across sessions.
+//
+
+#ifndef KISSFFT_WISDOM_HH
+#define KISSFFT_WISDOM_HH
+
+#include <string>
+
+/**
+ * The fastest kissfft_batch<float> backend for each transform length.
+ *
+ * Tuning is off until enable() is called. From then on, the first plan of a length that the wisdom doesn't cover
+ * times every backend the CPU can run on a batch of that length, and the fastest one is used for that length
+ * from then on. Each new result is written to the wisdom file right away, so later sessions that enable the same
+ * file start with the best backends without timing them again. Lengths whose entries name backends the CPU can't
+ * run (e.g. in a file shared with another machine) are timed again, and both machines' entries are kept.
+ *
+ * All functions are thread-safe. Concurrent plans of an untuned length wait for a single tuning.
+ */
+class kissfft_wisdom
+{
+    public:
+        /**
+         * Turns tuning on, reading the wisdom already in the file (which need not exist yet).
+         * \param path the wisdom file; empty to tune without keeping the results
+         */
+        static void enable(const std::string & path);
+
+        /**
+         * Turns tuning off and forgets the wisdom; plans use the default backend again.
+         */
+        static void disable();
+
+        /** Whether tuning is on. */
+        static bool enabled();
+
+        /**
+         * Gets the fastest backend for transforms of length nfft, timing the backends first if the wisdom doesn't
+         * cover the length.
+         * \return the backend's name, or NULL if tuning is off
+         */
+        static const char * best(int nfft, bool inverse);
+
+        /**
+         * Gets the default wisdom file: $TESSENDORF_FFT_WISDOM if set, otherwise .tessendorfOcean.wisdom in the
+         * user's home directory.
+         */
+        static std::string defaultPath();
+};
+
+#endif
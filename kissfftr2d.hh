@@ -0,0 +1,184 @@
+//
+//  kissfftr2d.hh
+//  TessendorfOceanNode
+//
+//  Two-dimensional complex-to-real inverse FFT for Hermitian-symmetric spectra, built on
+//  the kissfft class.
+//
+
+#ifndef KISSFFTR2D_CLASS_HH
+#define KISSFFTR2D_CLASS_HH
+
+#include "kissfft_batch.hh"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/**
+ * An inverse 2D FFT from the non-negative half of a Hermitian spectrum to a real `rows` x `cols` grid.
+ *
+ * The input is `rows` x (cols/2 + 1) complex values, row-major: column n holds the x-frequencies n = 0..cols/2,
+ * row m holds the z-frequency m (in FFT order, so rows past rows/2 are the negative frequencies). The remaining
+ * frequencies are implied by F(-k) = conj(F(k)), which makes the output real.
+ *
+ * The transform runs in place. The real output overwrites the input buffer with a padded row stride of
+ * realStride() = 2 * (cols/2 + 1) scalars, so grid value (m, n) is at ((scalar_type*)data)[m * realStride() + n].
+ *
+ * Both passes are split into batches that touch disjoint parts of the grid and may run concurrently, each with
+ * its own scratch buffer of scratchSize() elements. The column pass must finish before the row pass starts.
+ * `cols` must be even.
+ *
+ * The 1D transforms of each batch run through kissfft_batch, so single-precision grids use the SIMD kernels.
+ */
+template <typename T_Scalar>
+class kissfftr2d
+{
+    public:
+        typedef kissfft_batch<T_Scalar> fft_type;
+        typedef typename fft_type::cpx_type cpx_type;
+        typedef T_Scalar scalar_type;
+
+        /**
+         * \param rows number of rows of the real output (the length of each column transform)
+         * \param cols number of columns of the real output; must be even
+         * \param batchBytes approximate size in bytes of the working set of one batch
+         */
+        kissfftr2d(int rows, int cols, size_t batchBytes = 256 * 1024)
+            :_rows(rows),_cols(cols),_halfCols(cols / 2 + 1),_rowFft(cols / 2, true),_colFft(rows, true)
+        {
+            // Post-rotation twiddles exp(+2 pi i k / cols) for splitting the half-length row transform.
+            _rowTwiddles.resize(cols / 2);
+            double phinc = 2 * acos(-1.) / cols;
+            for (int k = 0; k < cols / 2; ++k)
+                _rowTwiddles[k] = cpx_type((scalar_type)cos(k * phinc), (scalar_type)sin(k * phinc));
+
+            size_t rowBytes = sizeof(cpx_type) * _halfCols;
+            size_t colBytes = sizeof(cpx_type) * rows;
+            _rowsPerBatch = (int)std::min<size_t>(rows, std::max<size_t>(1, batchBytes / rowBytes));
+            _colsPerBatch = (int)std::min<size_t>(_halfCols, std::max<size_t>(1, batchBytes / colBytes));
+        }
+
+        /**
+         * The smallest even size of at least n without prime factors other than 2, 3 and 5, which the kissfft
+         * butterflies handle directly; like kiss_fft_next_fast_size, but valid for `cols` too. Other sizes
+         * work, but fall back to the slow generic butterfly.
+         */
+        static int fastSize(int n)
+        {
+            for (n = std::max(n + (n & 1), 2); ; n += 2) {
+                int m = n;
+                while (m % 2 == 0) m /= 2;
+                while (m % 3 == 0) m /= 3;
+                while (m % 5 == 0) m /= 5;
+                if (m == 1)
+                    return n;
+            }
+        }
+
+        int rows() const { return _rows; }
+        int cols() const { return _cols; }
+
+        /** Number of complex elements in each row of the half spectrum (cols/2 + 1). */
+        int halfCols() const { return _halfCols; }
+
+        /** Number of complex elements in the half spectrum. */
+        size_t spectrumSize() const { return (size_t)_rows * _halfCols; }
+
+        /** Row stride, in scalars, of the real output. */
+        int realStride() const { return 2 * _halfCols; }
+
+        /** The 1D transforms along the rows (of length cols/2) and down the columns (of length rows). */
+        const fft_type & rowTransform() const { return _rowFft; }
+        const fft_type & columnTransform() const { return _colFft; }
+
+        int columnBatches() const { return (_halfCols + _colsPerBatch - 1) / _colsPerBatch; }
+        int columnsPerBatch() const { return _colsPerBatch; }
+        int rowBatches() const { return (_rows + _rowsPerBatch - 1) / _rowsPerBatch; }
+
+        /** Number of complex elements of scratch space needed by one batch. */
+        size_t scratchSize() const
+        {
+            size_t columnPass = _colFft.scratchSize(_colsPerBatch);
+            size_t rowPass = (size_t)_rowsPerBatch * (_cols / 2) + _rowFft.scratchSize(_rowsPerBatch);
+            return std::max(columnPass, rowPass);
+        }
+
+        /**
+         * Transforms the whole spectrum in place: all column batches, then all row batches.
+         */
+        void transform(cpx_type * data) const
+        {
+            std::vector<cpx_type> scratch(scratchSize());
+            for (int b = 0; b < columnBatches(); ++b)
+                transformColumnBatch(data, b, &scratch[0]);
+            for (int b = 0; b < rowBatches(); ++b)
+                transformRowBatch(data, b, &scratch[0]);
+        }
+
+        /**
+         * Runs the complex inverse transforms down the columns of one column batch, in place.
+         */
+        void transformColumnBatch(cpx_type * data, int batch, cpx_type * scratch) const
+        {
+            int begin = batch * _colsPerBatch;
+            transformColumns(data, begin, std::min(begin + _colsPerBatch, _halfCols), scratch);
+        }
+
+        /**
+         * Runs the complex inverse transforms down columns [begin, end), in place. At most columnsPerBatch()
+         * columns fit in the scratch space. Columns that are entirely zero transform to zero, so a spectrum
+         * with few nonzero columns only needs those transformed before the row pass.
+         */
+        void transformColumns(cpx_type * data, int begin, int end, cpx_type * scratch) const
+        {
+            _colFft.transform(data + begin, _halfCols, 1, end - begin, scratch);
+        }
+
+        /**
+         * Runs the complex-to-real transforms along the rows of one row batch, in place.
+         *
+         * Each row of cols/2 + 1 Hermitian coefficients X is packed into cols/2 complex values
+         * Z[k] = (X[k] + conj(X[cols/2 - k])) + i exp(2 pi i k / cols) (X[k] - conj(X[cols/2 - k])),
+         * whose half-length inverse transform holds the even outputs in its real parts and the odd outputs in
+         * its imaginary parts.
+         */
+        void transformRowBatch(cpx_type * data, int batch, cpx_type * scratch) const
+        {
+            int begin = batch * _rowsPerBatch;
+            int end = std::min(begin + _rowsPerBatch, _rows);
+            int half = _cols / 2;
+            cpx_type * packed = scratch;
+            cpx_type * fftScratch = scratch + (size_t)(end - begin) * half;
+            const cpx_type i(0, 1);
+
+            for (int r = begin; r < end; ++r) {
+                const cpx_type * row = data + (size_t)r * _halfCols;
+                cpx_type * z = packed + (size_t)(r - begin) * half;
+
+                for (int k = 0; k < half; ++k) {
+                    cpx_type a = row[k];
+                    cpx_type b = conj(row[half - k]);
+                    z[k] = (a + b) + i * _rowTwiddles[k] * (a - b);
+                }
+            }
+
+            _rowFft.transform(packed, 1, half, end - begin, fftScratch);
+
+            // Element j of each result is (x[2j], x[2j+1]), which is exactly the interleaved real layout of the row.
+            for (int r = begin; r < end; ++r) {
+                const cpx_type * z = packed + (size_t)(r - begin) * half;
+                std::copy(z, z + half, data + (size_t)r * _halfCols);
+            }
+        }
+
+    private:
+        int _rows;
+        int _cols;
+        int _halfCols;
+        int _rowsPerBatch;
+        int _colsPerBatch;
+        fft_type _rowFft;
+        fft_type _colFft;
+        std::vector<cpx_type> _rowTwiddles;
+};
+#endif
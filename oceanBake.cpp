@@ -0,0 +1,363 @@
+//
+//  oceanBake.cpp
+//  TessendorfOceanNode
+//
+
+#include "oceanBake.h"
+
+#include <cmath>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Rounds a size up to a whole number of bake blocks.
+ */
+static uint64_t round_to_block(uint64_t bytes)
+{
+    return (bytes + OCEAN_BAKE_BLOCK - 1) / OCEAN_BAKE_BLOCK * OCEAN_BAKE_BLOCK;
+}
+
+#ifdef _WIN32
+
+/**
+ * Gets the volume serial number and file index of an open file, which identify it like device and inode.
+ */
+static bool file_id(HANDLE file, uint64_t id[2])
+{
+    BY_HANDLE_FILE_INFORMATION info;
+    if (!GetFileInformationByHandle(file, &info)) {
+        return false;
+    }
+    id[0] = info.dwVolumeSerialNumber;
+    id[1] = ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+    return true;
+}
+
+static HANDLE open_file(const char* path)
+{
+    return CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+}
+
+/**
+ * Maps a whole file for reading.
+ * \return the mapping, or NULL if the file can't be opened or is smaller than `minBytes`
+ */
+static void* map_file(const char* path, size_t minBytes, size_t& bytes, uint64_t id[2])
+{
+    HANDLE file = open_file(path);
+    if (file == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+
+    LARGE_INTEGER size;
+    void* data = NULL;
+    if (GetFileSizeEx(file, &size) && (uint64_t)size.QuadPart >= minBytes && file_id(file, id)) {
+        HANDLE section = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (section) {
+            data = MapViewOfFile(section, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(section); // The view keeps the section and the file open.
+        }
+        bytes = (size_t)size.QuadPart;
+    }
+    CloseHandle(file);
+    return data;
+}
+
+static void unmap_file(void* data, size_t)
+{
+    UnmapViewOfFile(data);
+}
+
+static bool is_file(const char* path, const uint64_t id[2])
+{
+    HANDLE file = open_file(path);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    uint64_t current[2];
+    bool same = file_id(file, current) && current[0] == id[0] && current[1] == id[1];
+    CloseHandle(file);
+    return same;
+}
+
+/**
+ * Moves a file over another; unlike rename(), replaces an existing file on Windows too. A bake that a reader
+ * still has mapped can't be replaced on Windows, so the move fails until the reader closes it.
+ */
+static bool replace_file(const char* from, const char* to)
+{
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+static void will_need(const void*, size_t)
+{
+    // Windows reads ahead in mapped files by itself; PrefetchVirtualMemory isn't available before Windows 8.
+}
+
+#else
+
+/**
+ * Maps a whole file for reading, and gets its device and inode.
+ * \return the mapping, or NULL if the file can't be opened or is smaller than `minBytes`
+ */
+static void* map_file(const char* path, size_t minBytes, size_t& bytes, uint64_t id[2])
+{
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat info;
+    bool ok = fstat(fd, &info) == 0 && (size_t)info.st_size >= minBytes;
+    void* data = ok ? mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd); // The mapping keeps the file open.
+
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    bytes = info.st_size;
+    id[0] = info.st_dev;
+    id[1] = info.st_ino;
+    return data;
+}
+
+static void unmap_file(void* data, size_t bytes)
+{
+    munmap(data, bytes);
+}
+
+static bool is_file(const char* path, const uint64_t id[2])
+{
+    struct stat info;
+    return stat(path, &info) == 0 && (uint64_t)info.st_dev == id[0] && (uint64_t)info.st_ino == id[1];
+}
+
+static bool replace_file(const char* from, const char* to)
+{
+    return rename(from, to) == 0;
+}
+
+static void will_need(const void* data, size_t bytes)
+{
+    madvise(const_cast<void*>(data), bytes, MADV_WILLNEED);
+}
+
+#endif
+
+oceanBakeWriter::oceanBakeWriter()
+    : file(NULL), framesWritten(0)
+{
+    memset(&header, 0, sizeof(header));
+}
+
+oceanBakeWriter::~oceanBakeWriter()
+{
+    abort();
+}
+
+bool oceanBakeWriter::open(const char* filePath, const oceanBakeParams& params, double fps, int firstFrame, int frameCount)
+{
+    abort();
+
+    path = filePath;
+    tempPath = path + ".tmp";
+    file = fopen(tempPath.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, OCEAN_BAKE_MAGIC, sizeof(header.magic));
+    header.version = OCEAN_BAKE_VERSION;
+    header.headerBytes = (uint32_t)round_to_block(sizeof(header));
+    header.pointCount = (uint64_t)params.resX * params.resZ;
+    header.frameBytes = round_to_block(header.pointCount * 3 * sizeof(float));
+    header.fps = fps;
+    header.firstFrame = firstFrame;
+    header.frameCount = frameCount;
+    header.params = params;
+    framesWritten = 0;
+
+    // The header block is written as zeros for now and filled in by close(), so a bake that never finished can't
+    // be mistaken for a valid one.
+    block.assign(header.headerBytes / sizeof(float), 0.f);
+    if (fwrite(&block[0], 1, header.headerBytes, file) != header.headerBytes) {
+        abort();
+        return false;
+    }
+    block.assign(header.frameBytes / sizeof(float), 0.f);
+    return true;
+}
+
+bool oceanBakeWriter::openLoop(const char* filePath, const oceanBakeParams& params, double fps)
+{
+    double frames = params.period * fps;
+    double whole = floor(frames + .5);
+    if (whole < 1. || fabs(frames - whole) > 1e-6 * whole) {
+        return false;
+    }
+
+    if (!open(filePath, params, fps, 0, (int)whole)) {
+        return false;
+    }
+    header.loop = 1;
+    return true;
+}
+
+bool oceanBakeWriter::writeFrame(const float* points, size_t stride)
+{
+    if (!file || framesWritten >= header.frameCount) {
+        return false;
+    }
+
+    float* out = &block[0];
+    for (uint64_t i = 0; i < header.pointCount; i++) {
+        out[3 * i] = points[i * stride];
+        out[3 * i + 1] = points[i * stride + 1];
+        out[3 * i + 2] = points[i * stride + 2];
+    }
+
+    if (fwrite(out, 1, header.frameBytes, file) != header.frameBytes) {
+        return false;
+    }
+    framesWritten++;
+    return true;
+}
+
+bool oceanBakeWriter::close()
+{
+    if (!file || framesWritten != header.frameCount) {
+        abort();
+        return false;
+    }
+
+    bool ok = fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
+    file = NULL;
+
+    if (!ok || !replace_file(tempPath.c_str(), path.c_str())) {
+        remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+void oceanBakeWriter::abort()
+{
+    if (file) {
+        fclose(file);
+        file = NULL;
+        remove(tempPath.c_str());
+    }
+}
+
+oceanBakeReader::oceanBakeReader()
+    : mapping(NULL), mappingBytes(0)
+{
+    fileId[0] = fileId[1] = 0;
+}
+
+oceanBakeReader::~oceanBakeReader()
+{
+    close();
+}
+
+bool oceanBakeReader::open(const char* path)
+{
+    close();
+
+    size_t bytes = 0;
+    uint64_t id[2];
+    void* data = map_file(path, sizeof(oceanBakeHeader), bytes, id);
+    if (!data) {
+        return false;
+    }
+
+    const oceanBakeHeader& h = *reinterpret_cast<const oceanBakeHeader*>(data);
+    bool ok = memcmp(h.magic, OCEAN_BAKE_MAGIC, sizeof(h.magic)) == 0
+        && h.version == OCEAN_BAKE_VERSION
+        && h.headerBytes % OCEAN_BAKE_BLOCK == 0 && h.frameBytes % OCEAN_BAKE_BLOCK == 0
+        && h.pointCount == (uint64_t)h.params.resX * h.params.resZ
+        && h.frameBytes >= h.pointCount * 3 * sizeof(float)
+        && h.frameCount >= 0 && h.fps > 0.
+        && (!h.loop || (h.firstFrame == 0 && h.frameCount > 0 && h.params.period > 0.))
+        && (uint64_t)bytes >= h.headerBytes + h.frameBytes * h.frameCount;
+
+    if (!ok) {
+        unmap_file(data, bytes);
+        return false;
+    }
+
+    mapping = data;
+    mappingBytes = bytes;
+    filePath = path;
+    fileId[0] = id[0];
+    fileId[1] = id[1];
+    return true;
+}
+
+void oceanBakeReader::close()
+{
+    if (mapping) {
+        unmap_file(mapping, mappingBytes);
+        mapping = NULL;
+        mappingBytes = 0;
+    }
+    filePath.clear();
+    fileId[0] = fileId[1] = 0;
+}
+
+bool oceanBakeReader::isCurrent() const
+{
+    return mapping && is_file(filePath.c_str(), fileId);
+}
+
+int oceanBakeReader::frameIndex(double seconds) const
+{
+    if (!mapping) {
+        return -1;
+    }
+
+    const oceanBakeHeader& h = header();
+    if (h.loop) {
+        seconds = fmod(seconds, h.params.period);
+        seconds += seconds < 0. ? h.params.period : 0.;
+    }
+
+    double frame = seconds * h.fps;
+    double nearest = floor(frame + .5);
+    if (fabs(frame - nearest) > 1e-4) {
+        return -1; // Between baked frames.
+    }
+
+    if (h.loop && nearest >= h.frameCount) {
+        nearest -= h.frameCount; // Just below a whole period, which wraps to the first frame.
+    }
+
+    double index = nearest - h.firstFrame;
+    return index >= 0 && index < h.frameCount ? (int)index : -1;
+}
+
+const float* oceanBakeReader::frame(int index) const
+{
+    const oceanBakeHeader& h = header();
+    const char* base = static_cast<const char*>(mapping) + h.headerBytes;
+
+    int next = index + 1 < h.frameCount ? index + 1 : (h.loop ? 0 : -1);
+    if (next >= 0) {
+        will_need(base + next * h.frameBytes, h.frameBytes);
+    }
+
+    return reinterpret_cast<const float*>(base + index * h.frameBytes);
+}
@@ -0,0 +1,181 @@
+//
+//  oceanBake.h
+//  TessendorfOceanNode
+//
+//  On-disk cache of simulated frames. A bake is written once (e.g. by oceanSim --bake) and
+//  then played back by memory-mapping the file, without running the simulation.
+//
+
+#ifndef __TessendorfOceanNode__oceanBake__
+#define __TessendorfOceanNode__oceanBake__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/**
+ * The simulation parameters a bake was made with. A bake can stand in for a simulation only if these match
+ * exactly (frame times are checked separately).
+ */
+struct oceanBakeParams {
+    double  amplitude;      /* Height of the Phillips spectrum. */
+    double  windSpeed;      /* Wind speed (in m/s). */
+    double  windX;          /* X component of the wind direction, as passed to the simulation. */
+    double  windZ;          /* Z component of the wind direction, as passed to the simulation. */
+    double  choppiness;     /* Choppiness factor. */
+    double  scaleX;         /* Length of plane along X-axis (in m). */
+    double  scaleZ;         /* Length of plane along Z-axis (in m). */
+    double  waveSizeFilter; /* Size limit that waves must surpass to be rendered. */
+    int32_t resX;           /* Grid resolution, as passed to the simulation. */
+    int32_t resZ;
+    int32_t seed;           /* Seed for the pseudorandom number generator. */
+    int32_t precision;      /* Scalar type the frames were simulated in: a tessendorf::precision (0 single, 1 double). */
+    double  period;         /* Period T after which the simulation repeats (in s); see tessendorf::setPeriod. */
+
+    bool operator==(const oceanBakeParams& o) const
+    {
+        return amplitude == o.amplitude && windSpeed == o.windSpeed && windX == o.windX && windZ == o.windZ
+            && choppiness == o.choppiness && scaleX == o.scaleX && scaleZ == o.scaleZ
+            && waveSizeFilter == o.waveSizeFilter && resX == o.resX && resZ == o.resZ && seed == o.seed
+            && precision == o.precision && period == o.period;
+    }
+    bool operator!=(const oceanBakeParams& o) const { return !(*this == o); }
+};
+
+/**
+ * The header at the start of a bake file. The header occupies the first OCEAN_BAKE_BLOCK bytes, and frame i
+ * starts at headerBytes + i * frameBytes; both are multiples of OCEAN_BAKE_BLOCK (16 KB, a multiple of the page
+ * size on x86 and on Apple silicon), so every frame is page aligned in a mapping of the file. A frame holds
+ * resX * resZ points as packed (x, y, z) floats, in the order that tessendorf::simulate writes them, followed by
+ * zero padding up to frameBytes.
+ *
+ * A loop bake holds the frames at times 0, 1/fps, ... covering exactly one period of the simulation, which
+ * repeats forever, so it can play back any time t as t mod period.
+ *
+ * Values are stored in the byte order of the machine that wrote the file.
+ */
+struct oceanBakeHeader {
+    char            magic[8];       /* OCEAN_BAKE_MAGIC. */
+    uint32_t        version;        /* OCEAN_BAKE_VERSION. */
+    uint32_t        headerBytes;    /* Offset of the first frame. */
+    uint64_t        frameBytes;     /* Size of one frame block. */
+    uint64_t        pointCount;     /* Number of points per frame (resX * resZ). */
+    double          fps;            /* Frame rate used to convert frame numbers to simulation time. */
+    int32_t         firstFrame;     /* Frame number of the first baked frame. */
+    int32_t         frameCount;     /* Number of baked frames. */
+    int32_t         loop;           /* Nonzero for a loop bake (firstFrame is then 0). */
+    int32_t         reserved;       /* Padding; always zero. */
+    oceanBakeParams params;         /* Simulation parameters. */
+};
+
+#define OCEAN_BAKE_MAGIC    "TSOCBAKE"
+#define OCEAN_BAKE_VERSION  3
+#define OCEAN_BAKE_BLOCK    16384
+
+/**
+ * Writes a bake file frame by frame. The data goes to a temporary file that replaces `path` only when close()
+ * succeeds, so readers that have the old file mapped are never disturbed.
+ */
+class oceanBakeWriter {
+public:
+    oceanBakeWriter();
+    ~oceanBakeWriter();
+
+    /**
+     * Starts a bake of `frameCount` frames, beginning with frame number `firstFrame`.
+     * \return false if the file could not be created
+     */
+    bool                open(const char* path, const oceanBakeParams& params, double fps, int firstFrame, int frameCount);
+
+    /**
+     * Starts a loop bake: one period of the simulation (params.period seconds) at the given frame rate, beginning
+     * with frame 0. The period must be a whole number of frames.
+     * \return false if the period isn't a whole number of frames, or the file could not be created
+     */
+    bool                openLoop(const char* path, const oceanBakeParams& params, double fps);
+
+    /** Number of frames the bake expects (for a loop bake, the frames in one period). */
+    int                 frameCount() const { return header.frameCount; }
+
+    /**
+     * Appends the next frame. Point i is read as three floats (x, y, z) starting at points[i * stride].
+     * \return false on a write error, or if every frame has already been written
+     */
+    bool                writeFrame(const float* points, size_t stride = 3);
+
+    /**
+     * Finishes the bake and moves it into place.
+     * \return false if not every frame was written or the file could not be completed
+     */
+    bool                close();
+
+private:
+    oceanBakeWriter(const oceanBakeWriter&);
+    oceanBakeWriter& operator=(const oceanBakeWriter&);
+
+    void                abort();
+
+    FILE*               file;
+    std::string         path;
+    std::string         tempPath;
+    oceanBakeHeader     header;
+    int                 framesWritten;
+    std::vector<float>  block;      /* One frame block, reused for every frame. */
+};
+
+/**
+ * Memory-maps a bake file for playback. Frames are returned as pointers into the mapping, so reading a frame
+ * costs nothing until its pages are touched, and seeking to any frame is immediate.
+ */
+class oceanBakeReader {
+public:
+    oceanBakeReader();
+    ~oceanBakeReader();
+
+    /**
+     * Maps the given bake file, closing any file mapped before.
+     * \return false if the file is missing or isn't a valid bake
+     */
+    bool                open(const char* path);
+
+    void                close();
+
+    bool                isOpen() const { return mapping != NULL; }
+
+    /** The path given to the last successful open(). */
+    const std::string&  path() const { return filePath; }
+
+    /**
+     * Checks whether the file at path() is still the one that is mapped (it may have been re-baked since).
+     */
+    bool                isCurrent() const;
+
+    const oceanBakeHeader& header() const { return *reinterpret_cast<const oceanBakeHeader*>(mapping); }
+
+    /**
+     * Finds the frame baked for the given simulation time. A loop bake covers every time that falls on a frame,
+     * by wrapping the time into its period.
+     * \return the frame's index, or -1 if the time doesn't fall on a baked frame
+     */
+    int                 frameIndex(double seconds) const;
+
+    /**
+     * The points of the frame with the given index (0 <= index < header().frameCount), as packed (x, y, z) floats.
+     * Also asks the operating system to start reading the following frame, for smooth sequential playback.
+     */
+    const float*        frame(int index) const;
+
+private:
+    oceanBakeReader(const oceanBakeReader&);
+    oceanBakeReader& operator=(const oceanBakeReader&);
+
+    void*               mapping;
+    size_t              mappingBytes;
+    std::string         filePath;
+    uint64_t            fileId[2];  /* Device and inode (volume and file index on Windows) of the mapped file; a
+                                       re-bake replaces the file, and with it the inode. */
+};
+
+#endif /* defined(__TessendorfOceanNode__oceanBake__) */
@@ -0,0 +1,277 @@
+//
+//  oceanBench.cpp
+//  TessendorfOceanNode
+//
+//  Benchmark for the simulation core. Times every stage of tessendorf::simulate() (the
+//  initial spectrum, the h~(k, t) fill, both passes of the inverse FFTs and the vertex
+//  assembly) at a range of power-of-two resolutions, on one thread and on all hardware
+//  threads, and writes the results as JSON so that builds can be compared.
+//
+
+#include "tessendorf.h"
+#include "spectrumCache.h"
+#include "threadPool.h"
+#include "kissfft_batch.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+/**
+ * Options for a benchmark run. The simulation parameters are the tessendorfOcean node's attribute defaults.
+ */
+struct benchOptions {
+    int     minPower = 4;           /* Smallest resolution, as a power of two. */
+    int     maxPower = 11;          /* Largest resolution, as a power of two. */
+    int     frames = 16;            /* Timed frames per resolution and thread count. */
+    tessendorf::evaluation evaluation = tessendorf::EVAL_FULL_FFT; /* How the fields are evaluated. */
+    tessendorf::precision precision = tessendorf::PRECISION_SINGLE; /* Scalar type of the grids and FFTs. */
+    const char* outputFile = NULL;  /* Write the JSON to this file instead of stdout. */
+};
+
+static void printUsage(const char* program)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "      --min P             smallest resolution 2^P (default 4)\n"
+            "      --max P             largest resolution 2^P (default 11)\n"
+            "      --frames F          timed frames per resolution and thread count (default 16)\n"
+            "      --evaluation E      auto, full, pruned or direct (default full, so that the FFTs are always timed)\n"
+            "      --double            simulate in double instead of single precision\n"
+            "  -o, --output FILE       write the JSON results to FILE instead of stdout\n",
+            program);
+}
+
+/**
+ * Parses the command line into the given options.
+ * \return false if the command line was malformed or help was requested
+ */
+static bool parseOptions(int argc, char** argv, benchOptions& opts)
+{
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+#define MATCH(shortName, longName) (strcmp(arg, shortName) == 0 || strcmp(arg, longName) == 0)
+        if (MATCH("-h", "--help")) {
+            return false;
+        } else if (strcmp(arg, "--double") == 0) {
+            opts.precision = tessendorf::PRECISION_DOUBLE;
+            continue;
+        }
+
+        if (!value) {
+            fprintf(stderr, "missing value for %s\n", arg);
+            return false;
+        }
+
+        if (strcmp(arg, "--min") == 0)              opts.minPower = atoi(value);
+        else if (strcmp(arg, "--max") == 0)         opts.maxPower = atoi(value);
+        else if (strcmp(arg, "--frames") == 0)      opts.frames = atoi(value);
+        else if (MATCH("-o", "--output"))           opts.outputFile = value;
+        else if (strcmp(arg, "--evaluation") == 0) {
+            if (strcmp(value, "auto") == 0)         opts.evaluation = tessendorf::EVAL_AUTO;
+            else if (strcmp(value, "full") == 0)    opts.evaluation = tessendorf::EVAL_FULL_FFT;
+            else if (strcmp(value, "pruned") == 0)  opts.evaluation = tessendorf::EVAL_PRUNED_FFT;
+            else if (strcmp(value, "direct") == 0)  opts.evaluation = tessendorf::EVAL_DIRECT_SUM;
+            else {
+                fprintf(stderr, "unknown evaluation %s\n", value);
+                return false;
+            }
+        }
+        else {
+            fprintf(stderr, "unknown option %s\n", arg);
+            return false;
+        }
+#undef MATCH
+        i++;
+    }
+
+    if (opts.minPower < 1 || opts.maxPower > 13 || opts.minPower > opts.maxPower || opts.frames < 1) {
+        fprintf(stderr, "invalid resolution range or frame count\n");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Gets the median of the given samples (which are reordered).
+ */
+static double median(std::vector<double>& samples)
+{
+    size_t middle = samples.size() / 2;
+    std::nth_element(samples.begin(), samples.begin() + middle, samples.end());
+    double upper = samples[middle];
+    if (samples.size() % 2 == 1) {
+        return upper;
+    }
+    return (*std::max_element(samples.begin(), samples.begin() + middle) + upper) / 2.;
+}
+
+/**
+ * The timings (in ms) of one resolution at one thread count.
+ */
+struct benchResult {
+    int     resolution;             /* Vertices per row and column. */
+    int     threads;                /* Simulation threads. */
+    double  coldSimulate;           /* First frame with an empty spectrum cache and a new workspace. */
+    double  spectrum;               /* P_h and h~0 of every wave, in the first frame. */
+    double  waveTables;             /* Wavevector tables, in the first frame. */
+    double  fill;                   /* Median h~(k, t) and displacement spectra fill. */
+    double  fftColumns;             /* Median column pass of the inverse FFTs. */
+    double  fftRows;                /* Median row pass of the inverse FFTs. */
+    double  assemble;               /* Median vertex assembly. */
+    double  simulate;               /* Median simulate(). */
+    double  simulateMin;            /* Fastest simulate(). */
+    double  simulateNormals;        /* Median simulate() with analytic normals and Jacobians. */
+};
+
+/**
+ * Creates the simulation of the given frame at the node's default attribute values.
+ */
+static tessendorf makeSimulation(const benchOptions& opts, int resolution, int threads, int frame)
+{
+    tessendorf simulation(0.001, 2., vector3(1., 0., 0.), 0.5, frame / 24., resolution, resolution, 100., 100.,
+                          1., 1);
+    simulation.setThreadCount(threads);
+    simulation.setEvaluation(opts.evaluation);
+    simulation.setPrecision(opts.precision);
+    return simulation;
+}
+
+/**
+ * Times one resolution at one thread count. Each frame is at a different time, so none of them reuses the fields
+ * of the one before.
+ */
+static benchResult runResolution(const benchOptions& opts, int resolution, int threads)
+{
+    typedef std::chrono::steady_clock clock;
+
+    benchResult result;
+    result.resolution = resolution;
+    result.threads = threads;
+
+    size_t vertices = (size_t)resolution * resolution;
+    std::vector<float> points(3 * vertices);
+    std::vector<float> normals(3 * vertices);
+    std::vector<float> jacobians(vertices);
+
+    // The first frame computes the initial spectrum and the wavevector tables; later frames find them cached.
+    spectrumCache::clear();
+    oceanWorkspace workspace;
+    tessendorf first = makeSimulation(opts, resolution, threads, 0);
+    clock::time_point start = clock::now();
+    first.simulate(workspace, &points[0], 3);
+    result.coldSimulate = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    result.spectrum = first.lastStageTimes().spectrum;
+    result.waveTables = first.lastStageTimes().waveTables;
+
+    std::vector<double> fill, fftColumns, fftRows, assemble, simulate, simulateNormals;
+    for (int frame = 1; frame <= opts.frames; frame++) {
+        tessendorf simulation = makeSimulation(opts, resolution, threads, frame);
+        start = clock::now();
+        simulation.simulate(workspace, &points[0], 3);
+        simulate.push_back(std::chrono::duration<double, std::milli>(clock::now() - start).count());
+
+        const tessendorf::stageTimes& stages = simulation.lastStageTimes();
+        fill.push_back(stages.fill);
+        fftColumns.push_back(stages.fftColumns);
+        fftRows.push_back(stages.fftRows);
+        assemble.push_back(stages.assemble);
+    }
+
+    // Normals need five more fields, so they are timed separately, at times the loop above didn't use.
+    for (int frame = 1; frame <= opts.frames; frame++) {
+        tessendorf simulation = makeSimulation(opts, resolution, threads, opts.frames + frame);
+        start = clock::now();
+        simulation.simulate(workspace, &points[0], 3, &normals[0], &jacobians[0]);
+        simulateNormals.push_back(std::chrono::duration<double, std::milli>(clock::now() - start).count());
+    }
+
+    result.fill = median(fill);
+    result.fftColumns = median(fftColumns);
+    result.fftRows = median(fftRows);
+    result.assemble = median(assemble);
+    result.simulateMin = *std::min_element(simulate.begin(), simulate.end());
+    result.simulate = median(simulate);
+    result.simulateNormals = median(simulateNormals);
+    return result;
+}
+
+/**
+ * Writes the build information, the options and the results as JSON.
+ */
+static void writeJson(FILE* out, const benchOptions& opts, const std::vector<benchResult>& results)
+{
+#if defined(__clang__)
+    const char* compiler = __VERSION__;
+#elif defined(__GNUC__)
+    const char* compiler = "gcc " __VERSION__;
+#else
+    const char* compiler = "unknown";
+#endif
+    kissfft_batch<float> probe(256, true);
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"build\": {\n");
+    fprintf(out, "    \"compiler\": \"%s\",\n", compiler);
+    fprintf(out, "    \"fftIsa\": \"%s\",\n", probe.isa());
+    fprintf(out, "    \"fftFixedLengths\": %s,\n", probe.fixedLength() ? "true" : "false");
+    fprintf(out, "    \"hardwareThreads\": %d\n", threadPool::hardwareThreads());
+    fprintf(out, "  },\n");
+    fprintf(out, "  \"options\": {\n");
+    fprintf(out, "    \"frames\": %d,\n", opts.frames);
+    fprintf(out, "    \"evaluation\": \"%s\",\n",
+            opts.evaluation == tessendorf::EVAL_AUTO ? "auto" : tessendorf::evaluationName(opts.evaluation));
+    fprintf(out, "    \"precision\": \"%s\"\n", tessendorf::precisionName(opts.precision));
+    fprintf(out, "  },\n");
+    fprintf(out, "  \"units\": \"ms\",\n");
+    fprintf(out, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const benchResult& r = results[i];
+        fprintf(out, "    { \"resolution\": %d, \"threads\": %d, \"coldSimulate\": %.4f, \"spectrum\": %.4f, "
+                "\"waveTables\": %.4f, \"fill\": %.4f, \"fftColumns\": %.4f, \"fftRows\": %.4f, \"assemble\": %.4f, "
+                "\"simulate\": %.4f, \"simulateMin\": %.4f, \"simulateNormals\": %.4f }%s\n",
+                r.resolution, r.threads, r.coldSimulate, r.spectrum, r.waveTables, r.fill, r.fftColumns, r.fftRows,
+                r.assemble, r.simulate, r.simulateMin, r.simulateNormals, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n");
+    fprintf(out, "}\n");
+}
+
+int main(int argc, char** argv)
+{
+    benchOptions opts;
+    if (!parseOptions(argc, argv, opts)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // With one hardware thread both runs are single-threaded, but both are kept so the output has the same shape.
+    int threadCounts[] = { 1, threadPool::hardwareThreads() };
+
+    std::vector<benchResult> results;
+    for (int power = opts.minPower; power <= opts.maxPower; power++) {
+        for (int t = 0; t < 2; t++) {
+            benchResult r = runResolution(opts, 1 << power, threadCounts[t]);
+            fprintf(stderr, "%5d x %-5d %2d thread%s: simulate %.3f ms\n", r.resolution, r.resolution, r.threads,
+                    r.threads == 1 ? " " : "s", r.simulate);
+            results.push_back(r);
+        }
+    }
+
+    FILE* out = stdout;
+    if (opts.outputFile && !(out = fopen(opts.outputFile, "w"))) {
+        fprintf(stderr, "can't create %s\n", opts.outputFile);
+        return 1;
+    }
+    writeJson(out, opts, results);
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
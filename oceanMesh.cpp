@@ -0,0 +1,66 @@
+//
+//  oceanMesh.cpp
+//  TessendorfOceanNode
+//
+
+#include "oceanMesh.h"
+#include "threadPool.h"
+
+#include <algorithm>
+
+oceanMesh::oceanMesh()
+    : cols(0), rowCount(0)
+{
+}
+
+bool oceanMesh::resize(int columns, int rows, int threads, bool points)
+{
+    if (columns == cols && rows == rowCount && points == !pointBuffer.empty()) {
+        return false;
+    }
+    cols = columns;
+    rowCount = rows;
+
+    // Every face is a quad. The rows of faces are independent, so each work item fills one; the vertex order
+    // matches the mesh the node built before the topology was cached.
+    int faceCols = cols - 1;
+    int faceRows = rowCount - 1;
+    degrees.assign((size_t)faceCount(), 4);
+    connects.resize((size_t)faceCount() * 4);
+    threadPool::shared().parallelFor(faceRows, threadPool::resolveThreads(threads), [&](int i, int) {
+        int* face = &connects[(size_t)i * faceCols * 4];
+        for (int j = 0; j < faceCols; j++, face += 4) {
+            face[0] = (i + 1) * cols + j;
+            face[1] = (i + 1) * cols + j + 1;
+            face[2] = i * cols + j + 1;
+            face[3] = i * cols + j;
+        }
+    });
+
+    if (points) {
+        pointBuffer.assign((size_t)vertexCount() * 4, 1.f);
+    } else {
+        std::vector<float>().swap(pointBuffer);
+    }
+    normalBuffer.clear();
+    jacobianBuffer.clear();
+    return true;
+}
+
+float* oceanMesh::normals()
+{
+    normalBuffer.resize((size_t)vertexCount() * 3);
+    return normalBuffer.data();
+}
+
+float* oceanMesh::jacobians()
+{
+    jacobianBuffer.resize((size_t)vertexCount());
+    return jacobianBuffer.data();
+}
+
+size_t oceanMesh::bytes() const
+{
+    return (degrees.size() + connects.size()) * sizeof(int)
+        + (pointBuffer.size() + normalBuffer.size() + jacobianBuffer.size()) * sizeof(float);
+}
@@ -0,0 +1,67 @@
+//
+//  oceanMesh.h
+//  TessendorfOceanNode
+//
+//  The Maya-independent part of the ocean mesh: the quad topology of the vertex grid and the
+//  per-vertex buffers that the simulation writes into, in the layouts Maya copies in bulk.
+//
+
+#ifndef __TessendorfOceanNode__oceanMesh__
+#define __TessendorfOceanNode__oceanMesh__
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * The mesh of a grid of vertices, `columns` along the X-axis by `rows` along the Z-axis, in the vertex order of
+ * tessendorf::simulate (row-major, rows along Z). Each cell of the grid is a quad.
+ *
+ * The topology only depends on the grid size, so it is built once per size and kept: resize() rebuilds it only
+ * when the size changes, filling the face arrays a row of quads per work item on the shared thread pool. The
+ * point buffer holds (x, y, z, 1) per vertex, which is MFloatPointArray's layout, so the simulation can write
+ * straight into it with a stride of 4 floats; w is only written when the buffer is resized.
+ */
+class oceanMesh {
+public:
+    oceanMesh();
+
+    /**
+     * Sets the size of the grid, rebuilding the topology and resizing the buffers if it changed.
+     * \param threads number of threads for the rebuild (< 1 for all hardware threads)
+     * \param points whether to allocate the point buffer; callers that keep the points elsewhere pass false
+     * \return whether the topology changed
+     */
+    bool                resize(int columns, int rows, int threads, bool points = true);
+
+    int                 columns() const { return cols; }
+    int                 rows() const { return rowCount; }
+    int                 vertexCount() const { return cols * rowCount; }
+    int                 faceCount() const { return (cols - 1) * (rowCount - 1); }
+
+    /** The number of vertices of each face (all 4), faceCount() entries. */
+    const int*          faceDegrees() const { return degrees.data(); }
+
+    /** The vertex indices of each face, 4 per face, counterclockwise seen from +Y. */
+    const int*          faceVertices() const { return connects.data(); }
+
+    /** (x, y, z, 1) for each vertex, if resize() allocated them. */
+    float*              points() { return pointBuffer.data(); }
+
+    /** Buffers for analytic normals (3 floats per vertex) and Jacobians (1 float per vertex), sized on demand. */
+    float*              normals();
+    float*              jacobians();
+
+    /** Total bytes held by the topology and the buffers. */
+    size_t              bytes() const;
+
+private:
+    int                 cols;           /* Number of vertices along the X-axis. */
+    int                 rowCount;       /* Number of vertices along the Z-axis. */
+    std::vector<int>    degrees;        /* Vertices per face. */
+    std::vector<int>    connects;       /* Vertex indices of the faces. */
+    std::vector<float>  pointBuffer;    /* Vertices as (x, y, z, w) quadruples. */
+    std::vector<float>  normalBuffer;   /* Analytic normals, 3 floats per vertex. */
+    std::vector<float>  jacobianBuffer; /* Jacobian determinants, 1 float per vertex. */
+};
+
+#endif /* defined(__TessendorfOceanNode__oceanMesh__) */
@@ -0,0 +1,156 @@
+//
+//  oceanNodeAttributes.cpp
+//  TessendorfOceanNode
+//
+
+#include "oceanNodeAttributes.h"
+
+#include <maya/MFnNumericAttribute.h>
+#include <maya/MFnUnitAttribute.h>
+#include <maya/MDataHandle.h>
+
+#include <cmath>
+
+tessendorf oceanSettings::simulation() const
+{
+    // Convert wind direction to a unit vector.
+    double dirRadians = windDirection.asRadians();
+    vector3 dirVector = vector3(cos(dirRadians), 0., sin(dirRadians));
+    
+    tessendorf result(amplitude, windSpeed, dirVector, choppiness, time.as(MTime::kSeconds), resolutionX, resolutionZ, planeSize, planeSize, waveSizeFilter, seed);
+    result.setThreadCount(threads);
+    result.setPeriod(period);
+    return result;
+}
+
+bool oceanSettings::operator==(const oceanSettings& o) const
+{
+    return time.as(MTime::kSeconds) == o.time.as(MTime::kSeconds) && resolutionX == o.resolutionX
+        && resolutionZ == o.resolutionZ && planeSize == o.planeSize && waveSizeFilter == o.waveSizeFilter
+        && amplitude == o.amplitude
+        && windSpeed == o.windSpeed && windDirection.asRadians() == o.windDirection.asRadians()
+        && choppiness == o.choppiness && seed == o.seed && period == o.period && cascades == o.cascades
+        && cascadeRatio == o.cascadeRatio;
+}
+
+MStatus oceanNodeAttributes::create()
+{
+    MFnUnitAttribute unitAttr;
+    MFnNumericAttribute numAttr;
+    
+    // Time
+    time = unitAttr.create("time", "tm", MFnUnitAttribute::kTime, 0.0);
+    
+    // Resolution (powers of 2 between 16 and 2048)
+    resolution = numAttr.create("resolution", "res", MFnNumericData::kInt, 8);
+    numAttr.setMin(4);
+    numAttr.setMax(11);
+    
+    // Resolution along each axis (0 follows resolution)
+    resolutionX = numAttr.create("resolutionX", "rsx", MFnNumericData::kInt, 0);
+    numAttr.setMin(0);
+    numAttr.setSoftMax(2048);
+    numAttr.setMax(4096);
+    
+    resolutionZ = numAttr.create("resolutionZ", "rsz", MFnNumericData::kInt, 0);
+    numAttr.setMin(0);
+    numAttr.setSoftMax(2048);
+    numAttr.setMax(4096);
+    
+    // Plane size
+    planeSize = numAttr.create("planeSize", "psz", MFnNumericData::kDouble, 100.);
+    numAttr.setMin(10.);
+    numAttr.setMax(500.);
+    
+    // Wave size
+    waveSizeFilter = numAttr.create("waveSizeFilter", "wsz", MFnNumericData::kDouble, 1.);
+    numAttr.setMin(0.);
+    numAttr.setMax(50.);
+    
+    // Amplitude <= 1.0
+    amplitude = numAttr.create("amplitude", "a", MFnNumericData::kDouble, 0.001);
+    numAttr.setMin(0.);
+    numAttr.setMax(0.1);
+    
+    // Wind speed
+    windSpeed = numAttr.create("windSpeed", "ws", MFnNumericData::kDouble, 2.);
+    numAttr.setMin(0.);
+    numAttr.setMax(20.);
+    
+    // Wind direction (degrees)
+    windDirection = unitAttr.create("windDirection", "wd", MAngle(0.));
+    
+    // Choppiness
+    choppiness = numAttr.create("choppiness", "c", MFnNumericData::kDouble, 0.5);
+    numAttr.setMin(0.);
+    numAttr.setMax(2.);
+    
+    // Seed for PRNG
+    seed = numAttr.create("seed", "seed", MFnNumericData::kInt, 1);
+    
+    // Loop period
+    period = numAttr.create("period", "per", MFnNumericData::kDouble, 240.);
+    numAttr.setMin(1.);
+    numAttr.setSoftMax(600.);
+    
+    // Simulation threads (0 = all hardware threads)
+    threads = numAttr.create("threads", "thr", MFnNumericData::kInt, 0);
+    numAttr.setMin(0);
+    
+    // Cascades, each ratio times smaller than the one before
+    cascades = numAttr.create("cascades", "csc", MFnNumericData::kInt, 1);
+    numAttr.setMin(1);
+    numAttr.setMax(4);
+    
+    cascadeRatio = numAttr.create("cascadeRatio", "csr", MFnNumericData::kDouble, 8.);
+    numAttr.setMin(2.);
+    numAttr.setSoftMax(32.);
+    
+    return MS::kSuccess;
+}
+
+std::vector<MObject> oceanNodeAttributes::all() const
+{
+    MObject attributes[] = { time, resolution, resolutionX, resolutionZ, planeSize, waveSizeFilter, amplitude, windSpeed, windDirection,
+                             choppiness, seed, period, threads, cascades, cascadeRatio };
+    return std::vector<MObject>(attributes, attributes + sizeof(attributes) / sizeof(attributes[0]));
+}
+
+MStatus oceanNodeAttributes::read(MDataBlock& data, oceanSettings& settings) const
+{
+    MStatus status;
+    
+    settings.time = data.inputValue(time, &status).asTime();
+    if (!status) return status;
+    int resolutionPower = (int)pow(2, data.inputValue(resolution, &status).asInt());
+    if (!status) return status;
+    settings.resolutionX = data.inputValue(resolutionX, &status).asInt();
+    if (!status) return status;
+    settings.resolutionX = settings.resolutionX > 0 ? kissfftr2d<float>::fastSize(settings.resolutionX) : resolutionPower;
+    settings.resolutionZ = data.inputValue(resolutionZ, &status).asInt();
+    if (!status) return status;
+    settings.resolutionZ = settings.resolutionZ > 0 ? kissfftr2d<float>::fastSize(settings.resolutionZ) : resolutionPower;
+    settings.planeSize = data.inputValue(planeSize, &status).asDouble();
+    if (!status) return status;
+    settings.waveSizeFilter = data.inputValue(waveSizeFilter, &status).asDouble();
+    if (!status) return status;
+    settings.amplitude = data.inputValue(amplitude, &status).asDouble();
+    if (!status) return status;
+    settings.windSpeed = data.inputValue(windSpeed, &status).asDouble();
+    if (!status) return status;
+    settings.windDirection = data.inputValue(windDirection, &status).asAngle();
+    if (!status) return status;
+    settings.choppiness = data.inputValue(choppiness, &status).asDouble();
+    if (!status) return status;
+    settings.seed = data.inputValue(seed, &status).asInt();
+    if (!status) return status;
+    settings.period = data.inputValue(period, &status).asDouble();
+    if (!status) return status;
+    settings.threads = data.inputValue(threads, &status).asInt();
+    if (!status) return status;
+    settings.cascades = data.inputValue(cascades, &status).asInt();
+    if (!status) return status;
+    settings.cascadeRatio = data.inputValue(cascadeRatio, &status).asDouble();
+    
+    return status;
+}
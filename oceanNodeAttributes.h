@@ -0,0 +1,92 @@
+//
+//  oceanNodeAttributes.h
+//  TessendorfOceanNode
+//
+//  The simulation settings attributes shared by the nodes that sample the ocean, with the
+//  same names, defaults and ranges as on the tessendorfOcean node.
+//
+
+#ifndef __TessendorfOceanNode__oceanNodeAttributes__
+#define __TessendorfOceanNode__oceanNodeAttributes__
+
+#include <maya/MObject.h>
+#include <maya/MStatus.h>
+#include <maya/MTime.h>
+#include <maya/MAngle.h>
+#include <maya/MDataBlock.h>
+
+#include <vector>
+#include "tessendorf.h"
+
+/**
+ * Simulation settings, as read from a node's attributes.
+ */
+struct oceanSettings {
+    MTime   time;           /* The time passed in the simulation. */
+    int     resolutionX;    /* The number of vertices along the X-axis. */
+    int     resolutionZ;    /* The number of vertices along the Z-axis. */
+    double  planeSize;      /* The length or width of the ocean plane. */
+    double  waveSizeFilter; /* Waves smaller than this size are hidden. */
+    double  amplitude;      /* Determines the height of the waves. */
+    double  windSpeed;      /* The speed of waves. */
+    MAngle  windDirection;  /* The direction of the wave movement. */
+    double  choppiness;     /* Higher value is choppier. */
+    int     seed;           /* Seed for the pseudorandom number generator. */
+    double  period;         /* Time after which the simulation repeats (in s). */
+    int     threads;        /* Number of simulation threads (0 uses every hardware thread). */
+    int     cascades;       /* Number of cascades summed by the sampler (see tessendorf::cascade). */
+    double  cascadeRatio;   /* Size ratio between consecutive cascades. */
+    
+    /**
+     * Creates the simulation described by these settings.
+     */
+    tessendorf simulation() const;
+    
+    /**
+     * Checks whether two settings describe the same frame. The thread count doesn't change the result, so it
+     * is ignored.
+     */
+    bool operator==(const oceanSettings& o) const;
+    bool operator!=(const oceanSettings& o) const { return !(*this == o); }
+};
+
+/**
+ * The attributes holding the simulation settings. Each node type keeps a static instance, calls create() from its
+ * initialize function, and adds every attribute in all() (making each affect its outputs). Connecting the same
+ * attributes of a tessendorfOcean node keeps the nodes in agreement.
+ */
+class oceanNodeAttributes {
+public:
+    MObject time;
+    MObject resolution;
+    MObject resolutionX;
+    MObject resolutionZ;
+    MObject planeSize;
+    MObject waveSizeFilter;
+    MObject amplitude;
+    MObject windSpeed;
+    MObject windDirection;
+    MObject choppiness;
+    MObject seed;
+    MObject period;
+    MObject threads;
+    MObject cascades;       /* Only on the sampling nodes; the tessendorfOcean mesh is a single cascade. */
+    MObject cascadeRatio;
+    
+    /**
+     * Creates the attributes (without adding them to a node).
+     */
+    MStatus             create();
+    
+    /**
+     * Gets every attribute, for addAttribute and attributeAffects.
+     */
+    std::vector<MObject> all() const;
+    
+    /**
+     * Reads the settings from a node's data block.
+     */
+    MStatus             read(MDataBlock& data, oceanSettings& settings) const;
+};
+
+#endif /* defined(__TessendorfOceanNode__oceanNodeAttributes__) */
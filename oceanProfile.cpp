@@ -0,0 +1,170 @@
+//
+//  oceanProfile.cpp
+//  TessendorfOceanNode
+//
+
+#include "oceanProfile.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstring>
+
+oceanProfile::oceanProfile()
+{
+    reset();
+}
+
+void oceanProfile::reset()
+{
+    stages.clear();
+    bytesAllocated = 0;
+    spectrumHits = 0;
+    spectrumMisses = 0;
+    fieldHits = 0;
+    fieldMisses = 0;
+    threadTime.busy = 0.;
+    threadTime.available = 0.;
+    fftRowBackend = NULL;
+    fftColumnBackend = NULL;
+    fftRowFixed = false;
+    fftColumnFixed = false;
+}
+
+void oceanProfile::record(const char* name, clock::time_point start, clock::time_point end)
+{
+    span s = { name, start, std::chrono::duration<double, std::milli>(end - start).count() };
+    stages.push_back(s);
+}
+
+double oceanProfile::utilization() const
+{
+    return threadTime.available > 0. ? threadTime.busy / threadTime.available : 0.;
+}
+
+std::string oceanProfile::json() const
+{
+    // Stages that ran several times (e.g. once per cascade) are summed, in the order they first finished.
+    std::vector<const char*> names;
+    std::vector<double> totals;
+    for (size_t i = 0; i < stages.size(); i++) {
+        size_t n = 0;
+        while (n < names.size() && strcmp(names[n], stages[i].name) != 0) {
+            n++;
+        }
+        if (n == names.size()) {
+            names.push_back(stages[i].name);
+            totals.push_back(0.);
+        }
+        totals[n] += stages[i].ms;
+    }
+
+    std::string result = "{\"stages\": {";
+    char buffer[256];
+    for (size_t n = 0; n < names.size(); n++) {
+        snprintf(buffer, sizeof(buffer), "%s\"%s\": %.3f", n > 0 ? ", " : "", names[n], totals[n]);
+        result += buffer;
+    }
+    snprintf(buffer, sizeof(buffer),
+             "}, \"bytesAllocated\": %zu, \"spectrumCache\": {\"hits\": %d, \"misses\": %d}, "
+             "\"fieldCache\": {\"hits\": %d, \"misses\": %d}, "
+             "\"threads\": {\"busyMs\": %.3f, \"availableMs\": %.3f, \"utilization\": %.3f}",
+             bytesAllocated, spectrumHits, spectrumMisses, fieldHits, fieldMisses, threadTime.busy,
+             threadTime.available, utilization());
+    result += buffer;
+    if (fftRowBackend && fftColumnBackend) {
+        snprintf(buffer, sizeof(buffer),
+                 ", \"fft\": {\"rows\": {\"backend\": \"%s\", \"fixedLength\": %s}, "
+                 "\"columns\": {\"backend\": \"%s\", \"fixedLength\": %s}}",
+                 fftRowBackend, fftRowFixed ? "true" : "false", fftColumnBackend, fftColumnFixed ? "true" : "false");
+        result += buffer;
+    }
+    result += "}";
+    return result;
+}
+
+oceanTrace::oceanTrace()
+    : file(NULL), first(true)
+{
+}
+
+oceanTrace::~oceanTrace()
+{
+    close();
+}
+
+bool oceanTrace::open(const std::string& path)
+{
+    close();
+
+    std::lock_guard<std::mutex> guard(lock);
+    file = fopen(path.c_str(), "w");
+    if (!file) {
+        return false;
+    }
+    filePath = path;
+    epoch = oceanProfile::clock::now();
+    first = true;
+    fputs("[\n", file);
+    return true;
+}
+
+void oceanTrace::close()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (!file) {
+        return;
+    }
+    fputs("\n]\n", file);
+    fclose(file);
+    file = NULL;
+    filePath.clear();
+}
+
+void oceanTrace::event(const char* format, ...)
+{
+    // Called with the lock held.
+    if (!first) {
+        fputs(",\n", file);
+    }
+    first = false;
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(file, format, args);
+    va_end(args);
+}
+
+void oceanTrace::write(const oceanProfile& profile, const std::string& process)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (!file) {
+        return;
+    }
+
+    if (first) {
+        event("{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"%s\"}}", process.c_str());
+    }
+
+    // Timestamps and durations are in microseconds.
+    double end = 0.;
+    const std::vector<oceanProfile::span>& spans = profile.spans();
+    for (size_t i = 0; i < spans.size(); i++) {
+        double start = std::chrono::duration<double, std::micro>(spans[i].start - epoch).count();
+        double duration = spans[i].ms * 1000.;
+        end = std::max(end, start + duration);
+        event("{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": 1}",
+              spans[i].name, process.c_str(), start, duration);
+    }
+
+    if (spans.empty()) {
+        end = std::chrono::duration<double, std::micro>(oceanProfile::clock::now() - epoch).count();
+    }
+    event("{\"name\": \"memory\", \"ph\": \"C\", \"ts\": %.3f, \"pid\": 1, \"args\": {\"bytesAllocated\": %zu}}",
+          end, profile.bytesAllocated);
+    event("{\"name\": \"caches\", \"ph\": \"C\", \"ts\": %.3f, \"pid\": 1, \"args\": {\"spectrumHits\": %d, "
+          "\"spectrumMisses\": %d, \"fieldHits\": %d, \"fieldMisses\": %d}}",
+          end, profile.spectrumHits, profile.spectrumMisses, profile.fieldHits, profile.fieldMisses);
+    event("{\"name\": \"threads\", \"ph\": \"C\", \"ts\": %.3f, \"pid\": 1, \"args\": {\"utilization\": %.3f}}",
+          end, profile.utilization());
+    fflush(file);
+}
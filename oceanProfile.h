@@ -0,0 +1,148 @@
+//
+//  oceanProfile.h
+//  TessendorfOceanNode
+//
+//  Lightweight instrumentation of an evaluation: the time of each stage, counters of memory, caches and threads,
+//  and a writer that streams them to a Chrome trace file (chrome://tracing, Perfetto) for offline analysis.
+//
+
+#ifndef __TessendorfOceanNode__oceanProfile__
+#define __TessendorfOceanNode__oceanProfile__
+
+#include "threadPool.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * The stages and counters of one evaluation (or of several, until it is reset). Filled by tessendorf (see
+ * tessendorf::setProfile) and by the nodes, which add their own stages with oceanScopedTimer.
+ */
+class oceanProfile {
+public:
+    typedef std::chrono::steady_clock clock;
+
+    /**
+     * A timed stage.
+     */
+    struct span {
+        const char*         name;       /* Name of the stage; a string literal. */
+        clock::time_point   start;
+        double              ms;         /* Duration (in ms). */
+    };
+
+    oceanProfile();
+
+    /**
+     * Forgets every stage and zeroes the counters.
+     */
+    void                reset();
+
+    /**
+     * Adds a stage that ran from `start` to `end`.
+     */
+    void                record(const char* name, clock::time_point start, clock::time_point end);
+
+    /** The stages, in the order they finished. */
+    const std::vector<span>& spans() const { return stages; }
+
+    /** The fraction of the requested thread time that the parallel loops kept busy (0 if none ran). */
+    double              utilization() const;
+
+    /**
+     * Formats the stages (summed by name, in ms) and the counters as a JSON object on one line, e.g.
+     * {"stages": {"fill": 1.2, ...}, "bytesAllocated": 0, "spectrumCache": {"hits": 1, "misses": 0}, ...}
+     * The FFT backends are included once an evaluation has run the FFTs.
+     */
+    std::string         json() const;
+
+    size_t              bytesAllocated;     /* Bytes of working memory allocated (growth of the workspace and the
+                                               mesh buffers, and new initial spectra). */
+    int                 spectrumHits;       /* Initial spectra found in spectrumCache... */
+    int                 spectrumMisses;     /* ...and computed. */
+    int                 fieldHits;          /* Evaluations that reused the fields left in the workspace... */
+    int                 fieldMisses;        /* ...and that computed them. */
+    threadPool::usage   threadTime;         /* Thread time of the parallel loops (see threadPool::setUsage). */
+    const char*         fftRowBackend;      /* FFT backend of the rows and of the columns in the last evaluation */
+    const char*         fftColumnBackend;   /* that ran the FFTs, or NULL... */
+    bool                fftRowFixed;        /* ...and whether they ran kernels specialized for their length (see */
+    bool                fftColumnFixed;     /* kissfft_batch::fixedLength). */
+
+private:
+    std::vector<span>   stages;             /* Timed stages, in the order they finished. */
+};
+
+/**
+ * Times the enclosing scope as a stage of a profile. Does nothing if the profile is NULL.
+ */
+class oceanScopedTimer {
+public:
+    oceanScopedTimer(oceanProfile* profile, const char* name)
+        : profile(profile), name(name), start(profile ? oceanProfile::clock::now() : oceanProfile::clock::time_point())
+    {
+    }
+
+    ~oceanScopedTimer()
+    {
+        if (profile) {
+            profile->record(name, start, oceanProfile::clock::now());
+        }
+    }
+
+private:
+    oceanScopedTimer(const oceanScopedTimer&);
+    oceanScopedTimer& operator=(const oceanScopedTimer&);
+
+    oceanProfile*       profile;
+    const char*         name;
+    oceanProfile::clock::time_point start;
+};
+
+/**
+ * Streams profiles to a file in the Chrome trace event format (the JSON array form). Every stage becomes a
+ * complete event and every profile a set of counter events. The file is flushed after each profile, and a trace
+ * cut short (e.g. by a crash) still loads, since the closing bracket of the array is optional.
+ */
+class oceanTrace {
+public:
+    oceanTrace();
+    ~oceanTrace();
+
+    /**
+     * Creates (or truncates) the trace file. Timestamps start at 0 when it is opened.
+     * \return false if the file can't be created
+     */
+    bool                open(const std::string& path);
+
+    /**
+     * Finishes and closes the trace file, if open.
+     */
+    void                close();
+
+    bool                isOpen() const { return file != NULL; }
+    const std::string&  path() const { return filePath; }
+
+    /**
+     * Appends the stages and counters of a profile.
+     * \param process name under which the events are grouped, e.g. the node's name
+     */
+    void                write(const oceanProfile& profile, const std::string& process);
+
+private:
+    oceanTrace(const oceanTrace&);
+    oceanTrace& operator=(const oceanTrace&);
+
+    void                event(const char* format, ...);
+
+    FILE*               file;
+    std::string         filePath;
+    oceanProfile::clock::time_point epoch;  /* Time 0 of the trace. */
+    bool                first;              /* Whether no event was written yet. */
+    std::mutex          lock;
+};
+
+#endif /* defined(__TessendorfOceanNode__oceanProfile__) */
@@ -0,0 +1,209 @@
+//
+//  oceanSampler.cpp
+//  TessendorfOceanNode
+//
+
+#include "oceanSampler.h"
+#include "tessendorf.h"
+#include "threadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+#define QUERY_BLOCK 256 // Queries per work item.
+
+/**
+ * The interpolated fields (x displacement, height, z displacement, unused) at one position, and their derivatives.
+ */
+struct oceanSampler::sample {
+    float value[4];
+    float ddx[4];
+    float ddz[4];
+};
+
+/**
+ * Computes the taps of the filter along one axis of a periodic grid of n samples, at grid coordinate u.
+ * \return the number of taps written to index, w (weights) and dw (derivatives of the weights with respect to u)
+ */
+static int filter_taps(oceanSampler::filter f, double u, int n, int* index, float* w, float* dw)
+{
+    double base = floor(u);
+    float t = (float)(u - base);
+    base -= floor(base / n) * n;
+    int i0 = std::min((int)base, n - 1);
+
+    int taps;
+    int first;
+    if (f == oceanSampler::BILINEAR) {
+        taps = 2;
+        first = i0;
+        w[0] = 1.f - t;         dw[0] = -1.f;
+        w[1] = t;               dw[1] = 1.f;
+    } else {
+        // Catmull-Rom spline through samples i0 - 1 .. i0 + 2.
+        float t2 = t * t;
+        float t3 = t2 * t;
+        taps = 4;
+        first = i0 - 1;
+        w[0] = .5f * (-t3 + 2.f * t2 - t);          dw[0] = .5f * (-3.f * t2 + 4.f * t - 1.f);
+        w[1] = .5f * (3.f * t3 - 5.f * t2 + 2.f);   dw[1] = .5f * (9.f * t2 - 10.f * t);
+        w[2] = .5f * (-3.f * t3 + 4.f * t2 + t);    dw[2] = .5f * (-9.f * t2 + 8.f * t + 1.f);
+        w[3] = .5f * (t3 - t2);                     dw[3] = .5f * (3.f * t2 - 2.f * t);
+    }
+
+    for (int i = 0; i < taps; i++) {
+        int k = first + i;
+        index[i] = k < 0 ? k + n : (k >= n ? k - n : k);
+    }
+    return taps;
+}
+
+oceanSampler::oceanSampler()
+    : activeLayers(0), interpolation(BICUBIC), iterations(3), threads(0)
+{
+}
+
+void oceanSampler::update(const tessendorf& simulation, oceanWorkspace& workspace)
+{
+    update(simulation, workspace, 1, 1.);
+}
+
+void oceanSampler::update(const tessendorf& simulation, oceanWorkspace& workspace, int count, double ratio)
+{
+    while ((int)layers.size() < count) {
+        layers.push_back(std::unique_ptr<layer>(new layer));
+    }
+    activeLayers = count;
+    for (size_t i = std::max(count, 1); i < layers.size(); i++) {
+        layers[i]->workspace.release(); // Unused cascades don't hold on to their grids.
+    }
+
+    for (int i = 0; i < count; i++) {
+        tessendorf cascade = simulation.cascade(i, count, ratio);
+        layer& l = *layers[i];
+        l.M = cascade.rows();
+        l.N = cascade.cols();
+        l.Lx = cascade.sizeX();
+        l.Lz = cascade.sizeZ();
+
+        bool resized = l.texels.size() != (size_t)l.M * l.N * 4;
+        l.texels.resize((size_t)l.M * l.N * 4);
+        if (resized) {
+            std::fill(l.texels.data(), l.texels.data() + l.texels.size(), 0.f); // The fourth component is never written.
+        }
+        cascade.simulateFields(i == 0 ? workspace : l.workspace, l.texels.data(), 4);
+    }
+}
+
+void oceanSampler::evaluate(double x, double z, bool derivatives, sample& result) const
+{
+    for (int c = 0; c < 4; c++) {
+        result.value[c] = result.ddx[c] = result.ddz[c] = 0.f;
+    }
+    for (int i = 0; i < activeLayers; i++) {
+        evaluate(*layers[i], x, z, derivatives, result);
+    }
+}
+
+void oceanSampler::evaluate(const layer& l, double x, double z, bool derivatives, sample& result) const
+{
+    int M = l.M;
+    int N = l.N;
+    int xIndex[4], zIndex[4];
+    float wx[4], dwx[4], wz[4], dwz[4];
+    int xTaps = filter_taps(interpolation, x * N / l.Lx, N, xIndex, wx, dwx);
+    int zTaps = filter_taps(interpolation, z * M / l.Lz, M, zIndex, wz, dwz);
+
+    float value[4] = { 0.f, 0.f, 0.f, 0.f };
+    float ddx[4] = { 0.f, 0.f, 0.f, 0.f };
+    float ddz[4] = { 0.f, 0.f, 0.f, 0.f };
+
+    // All three fields are filtered together, four floats at a time.
+    for (int j = 0; j < zTaps; j++) {
+        const float* row = l.texels.data() + (size_t)zIndex[j] * N * 4;
+        float r[4] = { 0.f, 0.f, 0.f, 0.f };
+        float rd[4] = { 0.f, 0.f, 0.f, 0.f };
+
+        for (int i = 0; i < xTaps; i++) {
+            const float* texel = row + xIndex[i] * 4;
+            for (int c = 0; c < 4; c++) {
+                r[c] += wx[i] * texel[c];
+                rd[c] += dwx[i] * texel[c];
+            }
+        }
+
+        for (int c = 0; c < 4; c++) {
+            value[c] += wz[j] * r[c];
+        }
+        if (derivatives) {
+            for (int c = 0; c < 4; c++) {
+                ddx[c] += wz[j] * rd[c];
+                ddz[c] += dwz[j] * r[c];
+            }
+        }
+    }
+
+    // The weights were differentiated with respect to grid coordinates; convert to world units.
+    float xScale = (float)(N / l.Lx);
+    float zScale = (float)(M / l.Lz);
+    for (int c = 0; c < 4; c++) {
+        result.value[c] += value[c];
+        result.ddx[c] += ddx[c] * xScale;
+        result.ddz[c] += ddz[c] * zScale;
+    }
+}
+
+void oceanSampler::query(const oceanQuery& q) const
+{
+    if (isEmpty() || q.count == 0) {
+        return;
+    }
+
+    int blocks = (int)((q.count + QUERY_BLOCK - 1) / QUERY_BLOCK);
+    bool derivatives = q.normals != NULL;
+
+    threadPool::shared().parallelFor(blocks, threadPool::resolveThreads(threads), [&](int b, int) {
+        size_t begin = (size_t)b * QUERY_BLOCK;
+        size_t end = std::min(begin + QUERY_BLOCK, q.count);
+        sample s;
+
+        for (size_t i = begin; i < end; i++) {
+            double qx = q.positions[i * q.stride];
+            double qz = q.positions[i * q.stride + 2];
+
+            // Find the rest position p that is displaced onto q: p = q - D(p).
+            double px = qx;
+            double pz = qz;
+            for (int it = 0; it < iterations; it++) {
+                evaluate(px, pz, false, s);
+                px = qx - s.value[0];
+                pz = qz - s.value[2];
+            }
+            evaluate(px, pz, derivatives, s);
+
+            if (q.heights) {
+                q.heights[i] = s.value[1];
+            }
+
+            if (q.displacements) {
+                q.displacements[3 * i] = s.value[0];
+                q.displacements[3 * i + 1] = s.value[1];
+                q.displacements[3 * i + 2] = s.value[2];
+            }
+
+            if (q.normals) {
+                // The surface is S(p) = (p.x + Dx, h, p.z + Dz); its normal is dS/dz x dS/dx.
+                float ax = s.ddz[0],        ay = s.ddz[1], az = 1.f + s.ddz[2];
+                float bx = 1.f + s.ddx[0],  by = s.ddx[1], bz = s.ddx[2];
+                float nx = ay * bz - az * by;
+                float ny = az * bx - ax * bz;
+                float nz = ax * by - ay * bx;
+                float length = sqrtf(nx * nx + ny * ny + nz * nz);
+                float scale = length > 0.f ? 1.f / length : 0.f;
+                q.normals[3 * i] = nx * scale;
+                q.normals[3 * i + 1] = ny * scale;
+                q.normals[3 * i + 2] = nz * scale;
+            }
+        }
+    });
+}
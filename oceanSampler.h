@@ -0,0 +1,122 @@
+//
+//  oceanSampler.h
+//  TessendorfOceanNode
+//
+//  Point queries against a simulated frame: surface height, displacement and normal at
+//  arbitrary positions, for buoyancy and other effects that don't need the whole mesh.
+//
+
+#ifndef __TessendorfOceanNode__oceanSampler__
+#define __TessendorfOceanNode__oceanSampler__
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "oceanWorkspace.h"
+
+class tessendorf;
+
+/**
+ * A batch of point queries. Positions are in the ocean's space: the plane is centered on the origin and repeats
+ * every sizeX() along X and sizeZ() along Z, so any position can be queried. Output arrays are optional.
+ */
+struct oceanQuery {
+    size_t          count;          /* Number of positions. */
+    const float*    positions;      /* x at positions[i * stride], z at positions[i * stride + 2]; y is ignored. */
+    size_t          stride;         /* Distance in floats between consecutive positions (at least 3). */
+    float*          heights;        /* Receives the height of the surface above each position, or NULL. */
+    float*          displacements;  /* Receives (x, y, z) offsets, 3 floats each, or NULL; see oceanSampler::query. */
+    float*          normals;        /* Receives unit surface normals, 3 floats each, or NULL. */
+
+    oceanQuery() : count(0), positions(NULL), stride(3), heights(NULL), displacements(NULL), normals(NULL) {}
+};
+
+/**
+ * Holds the displacement fields of one simulated frame and answers batches of point queries against them.
+ * The frame may be made of several cascades (see tessendorf::cascade), whose fields are summed.
+ *
+ * The fields are interpolated from the periodic simulation grid with a bilinear or a bicubic (Catmull-Rom)
+ * filter. Each grid sample stores its three fields together, so the filter fetches them with one vector load;
+ * normals come from the derivatives of the same filter. Queries are split into blocks that run on the shared
+ * thread pool, and give the same results for any thread count.
+ */
+class oceanSampler {
+public:
+    enum filter {
+        BILINEAR = 0,
+        BICUBIC
+    };
+
+    oceanSampler();
+
+    /**
+     * Simulates the frame described by `simulation` and keeps its fields for querying.
+     */
+    void                update(const tessendorf& simulation, oceanWorkspace& workspace);
+
+    /**
+     * Simulates `count` cascades of the frame described by `simulation` (see tessendorf::cascade) and keeps all of
+     * their fields; queries then sum the cascades. Cascade 0 runs in `workspace`; the others run in workspaces
+     * kept by the sampler, one per cascade, since the wave tables, phase state and fields a workspace keeps between
+     * frames are only valid for one plane size.
+     */
+    void                update(const tessendorf& simulation, oceanWorkspace& workspace, int count, double ratio);
+
+    /** Whether update() has been called. */
+    bool                isEmpty() const { return activeLayers == 0; }
+
+    void                setFilter(filter f) { interpolation = f; }
+
+    /**
+     * Sets the number of fixed-point iterations used to undo the horizontal (choppy) displacement. Grid points
+     * are pushed sideways by the displacement, so the surface above a position comes from a rest position
+     * nearby; each iteration refines that rest position. 0 samples the fields at the query position itself.
+     */
+    void                setIterations(int count) { iterations = count; }
+
+    void                setThreadCount(int threadCount) { threads = threadCount; }
+
+    /**
+     * Answers a batch of queries. For each position q, finds the rest position p whose displaced surface point
+     * lies above q, then reports the height of that surface point, its displacement (x, y, z) from p (so the
+     * surface point is p + displacement, and the displacement's y is the height), and the surface normal there.
+     */
+    void                query(const oceanQuery& q) const;
+
+private:
+    oceanSampler(const oceanSampler&);
+    oceanSampler& operator=(const oceanSampler&);
+
+    struct sample;
+
+    /**
+     * The fields of one cascade.
+     */
+    struct layer {
+        int                 M;          /* Number of grid rows (along the Z-axis). */
+        int                 N;          /* Number of grid columns (along the X-axis). */
+        double              Lx;         /* Length of plane along X-axis (in m). */
+        double              Lz;         /* Length of plane along Z-axis (in m). */
+        alignedArray<float> texels;     /* (x displacement, height, z displacement, 0) for each grid sample, row-major. */
+        oceanWorkspace      workspace;  /* Simulates this cascade, unless it is cascade 0. */
+    };
+
+    /**
+     * Interpolates the fields of one layer at rest position (x, z), with their x and z derivatives if
+     * `derivatives` is set, and adds them to `result`.
+     */
+    void                evaluate(const layer& l, double x, double z, bool derivatives, sample& result) const;
+
+    /**
+     * Sums the fields of every layer at rest position (x, z).
+     */
+    void                evaluate(double x, double z, bool derivatives, sample& result) const;
+
+    std::vector< std::unique_ptr<layer> > layers;   /* Allocated layers; kept when fewer are in use. */
+    int                 activeLayers;   /* Number of layers in use. */
+    filter              interpolation;  /* Filter used by query. */
+    int                 iterations;     /* Fixed-point iterations used to undo the horizontal displacement. */
+    int                 threads;        /* Number of threads (< 1 for all hardware threads). */
+};
+
+#endif /* defined(__TessendorfOceanNode__oceanSampler__) */
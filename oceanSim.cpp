@@ -0,0 +1,1007 @@
+//
+//  oceanSim.cpp
+//  TessendorfOceanNode
+//
+//  Command-line driver for the simulation core. Runs tessendorf::simulate() over a
+//  range of frames without Maya and reports how long each frame took. Also bakes frames
+//  to a file for the node's cacheFile attribute, times playback of a bake, and times
+//  point queries and deformation through oceanSampler.
+//
+
+#include "tessendorf.h"
+#include "oceanBake.h"
+#include "oceanSampler.h"
+#include "oceanMesh.h"
+#include "oceanProfile.h"
+#include "threadPool.h"
+#include "kissfftr2d.hh"
+#include "kissfft_wisdom.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+/**
+ * Options for a command-line simulation run. Defaults match the tessendorfOcean node's attribute defaults.
+ */
+struct simOptions {
+    int     resolutionX = 256;      /* Number of vertices along the X-axis. */
+    int     resolutionZ = 256;      /* Number of vertices along the Z-axis. */
+    int     startFrame = 1;         /* First frame to simulate. */
+    int     endFrame = 24;          /* Last frame to simulate (inclusive). */
+    double  fps = 24.;              /* Frames per second; converts frame numbers to simulation time. */
+    double  planeSize = 100.;       /* Length or width of the ocean plane (in m). */
+    double  waveSizeFilter = 1.;    /* Waves smaller than this size are hidden. */
+    double  amplitude = 0.001;      /* Height of the Phillips spectrum. */
+    double  windSpeed = 2.;         /* Wind speed (in m/s). */
+    double  windDirection = 0.;     /* Wind direction (in degrees). */
+    double  choppiness = 0.5;       /* Choppiness factor. */
+    int     seed = 1;               /* Seed for the pseudorandom number generator. */
+    double  period = 240.;          /* Time after which the simulation repeats (in s). */
+    int     threads = 0;            /* Number of simulation threads (< 1 for all hardware threads). */
+    bool    verbose = false;        /* Print the time of every frame, not just the summary. */
+    bool    checkFft = false;       /* Check the single-precision FFT kernels against double precision and exit. */
+    bool    checkPrecision = false; /* Check single-precision simulations against double precision and exit. */
+    bool    checkCascades = false;  /* Check the energy of each cascade against one large grid and exit. */
+    bool    normals = false;        /* Also compute analytic normals and Jacobians for every simulated frame. */
+    bool    incremental = false;    /* Advance the phases from frame to frame instead of evaluating them. */
+    tessendorf::evaluation evaluation = tessendorf::EVAL_AUTO; /* How the fields are evaluated. */
+    tessendorf::precision precision = tessendorf::PRECISION_SINGLE; /* Scalar type of the grids and FFTs. */
+    const char* bakeFile = NULL;    /* Write the simulated frames to this bake file. */
+    const char* playFile = NULL;    /* Read the frames from this bake file instead of simulating. */
+    bool    loop = false;           /* Bake exactly one period, starting at frame 0, instead of the frame range. */
+    int     queries = 0;            /* Number of random point queries to time at the last frame (0 for none). */
+    int     deformPoints = 0;       /* Number of random points to deform at the last frame (0 for none). */
+    int     choppinessSteps = 0;    /* Number of choppiness values to sweep through at the last frame (0 for none). */
+    bool    mesh = false;           /* Time the node's mesh topology and point buffer at the last frame. */
+    bool    stats = false;          /* Print the stage times and counters of the last simulated frame. */
+    const char* traceFile = NULL;   /* Stream the stages of every simulated frame to this Chrome trace file. */
+    bool    tune = false;           /* Pick the fastest FFT backend for each length, as the node does. */
+    const char* wisdomFile = NULL;  /* Wisdom file for tuning (NULL for the default one). */
+    int     cascades = 1;           /* Number of cascades summed by the point queries and the deformer. */
+    double  cascadeRatio = 8.;      /* Size ratio between consecutive cascades. */
+    oceanSampler::filter filter = oceanSampler::BICUBIC; /* Interpolation used by the point queries. */
+};
+
+static void printUsage(const char* program)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -r, --resolution N      vertices per row/column (default 256), or NXxNZ for a rectangular grid; rounded\n"
+            "                          up to even sizes with no prime factors above 5, such as 768 or 1536\n"
+            "  -s, --start F           first frame (default 1)\n"
+            "  -e, --end F             last frame, inclusive (default 24)\n"
+            "  -f, --fps R             frames per second (default 24)\n"
+            "  -p, --plane-size L      plane size in m (default 100)\n"
+            "  -l, --wave-size-filter  wave size filter (default 1)\n"
+            "  -a, --amplitude A       spectrum amplitude (default 0.001)\n"
+            "  -w, --wind-speed V      wind speed in m/s (default 2)\n"
+            "  -d, --wind-direction D  wind direction in degrees (default 0)\n"
+            "  -c, --choppiness C      choppiness (default 0.5)\n"
+            "      --seed S            random seed (default 1)\n"
+            "      --period T          loop period in s (default 240)\n"
+            "  -j, --threads T         simulation threads (default: all hardware threads)\n"
+            "  -v, --verbose           print per-frame timings\n"
+            "      --incremental       advance the wave phases incrementally between frames, and check the last\n"
+            "                          frame against direct evaluation\n"
+            "      --evaluation E      auto, full, pruned or direct: how to evaluate the fields (default auto); a\n"
+            "                          sparse path is checked against the full FFT at the last frame\n"
+            "      --normals           also compute analytic normals and Jacobians, and check them against the mesh\n"
+            "      --double            simulate in double precision, and compare the last frame with single precision\n"
+            "      --bake FILE         also write the frames to a bake file\n"
+            "      --loop              with --bake, bake one loop period from frame 0 instead of the frame range\n"
+            "      --play FILE         play back the frames of a bake file instead of simulating\n"
+            "  -q, --queries Q         time Q random point queries at the last frame, and check them against the mesh\n"
+            "      --deform P          time deforming P random points at the last frame, and check the deformer on the grid\n"
+            "      --mesh              time building the node's mesh topology and simulating into its point buffer\n"
+            "      --stats             print the stage times and counters of the last simulated frame, as the node's\n"
+            "                          stats attribute does\n"
+            "      --trace FILE        write the stages of every simulated frame to a Chrome trace file\n"
+            "      --sweep-choppiness K  time re-simulating the last frame at K choppiness values, as when dragging the slider\n"
+            "      --bilinear          use bilinear instead of bicubic interpolation for the queries\n"
+            "      --cascades C        sum C cascades in the queries and the deformer (default 1)\n"
+            "      --cascade-ratio R   size ratio between consecutive cascades (default 8)\n"
+            "      --check-cascades    check the height RMS of each cascade's band at the last frame against the same\n"
+            "                          band of one grid as large as all the cascades together, and exit\n"
+            "      --tune              time the FFT backends on first use of each length and use the fastest, keeping\n"
+            "                          the results in the wisdom file, as the node does (default: widest SIMD kernel)\n"
+            "      --wisdom FILE       tune with this wisdom file instead of the default ($TESSENDORF_FFT_WISDOM or\n"
+            "                          ~/.tessendorfOcean.wisdom)\n"
+            "      --check-fft         check every float FFT backend against the double path and exit\n"
+            "      --check-precision   check single-precision simulations against double precision at several\n"
+            "                          resolutions and evaluation paths, and exit\n",
+            program);
+}
+
+/**
+ * Parses the command line into the given options.
+ * \return false if the command line was malformed or help was requested
+ */
+static bool parseOptions(int argc, char** argv, simOptions& opts)
+{
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+#define MATCH(shortName, longName) (strcmp(arg, shortName) == 0 || strcmp(arg, longName) == 0)
+        if (MATCH("-v", "--verbose")) {
+            opts.verbose = true;
+            continue;
+        } else if (strcmp(arg, "--check-fft") == 0) {
+            opts.checkFft = true;
+            continue;
+        } else if (strcmp(arg, "--check-precision") == 0) {
+            opts.checkPrecision = true;
+            continue;
+        } else if (strcmp(arg, "--check-cascades") == 0) {
+            opts.checkCascades = true;
+            continue;
+        } else if (strcmp(arg, "--double") == 0) {
+            opts.precision = tessendorf::PRECISION_DOUBLE;
+            continue;
+        } else if (strcmp(arg, "--incremental") == 0) {
+            opts.incremental = true;
+            continue;
+        } else if (strcmp(arg, "--mesh") == 0) {
+            opts.mesh = true;
+            continue;
+        } else if (strcmp(arg, "--tune") == 0) {
+            opts.tune = true;
+            continue;
+        } else if (strcmp(arg, "--stats") == 0) {
+            opts.stats = true;
+            continue;
+        } else if (strcmp(arg, "--normals") == 0) {
+            opts.normals = true;
+            continue;
+        } else if (strcmp(arg, "--bilinear") == 0) {
+            opts.filter = oceanSampler::BILINEAR;
+            continue;
+        } else if (strcmp(arg, "--loop") == 0) {
+            opts.loop = true;
+            continue;
+        } else if (MATCH("-h", "--help")) {
+            return false;
+        }
+
+        if (!value) {
+            fprintf(stderr, "missing value for %s\n", arg);
+            return false;
+        }
+
+        if (MATCH("-r", "--resolution")) {
+            if (sscanf(value, "%dx%d", &opts.resolutionX, &opts.resolutionZ) == 1) {
+                opts.resolutionZ = opts.resolutionX;
+            }
+        }
+        else if (MATCH("-s", "--start"))            opts.startFrame = atoi(value);
+        else if (MATCH("-e", "--end"))              opts.endFrame = atoi(value);
+        else if (MATCH("-f", "--fps"))              opts.fps = atof(value);
+        else if (MATCH("-p", "--plane-size"))       opts.planeSize = atof(value);
+        else if (MATCH("-l", "--wave-size-filter")) opts.waveSizeFilter = atof(value);
+        else if (MATCH("-a", "--amplitude"))        opts.amplitude = atof(value);
+        else if (MATCH("-w", "--wind-speed"))       opts.windSpeed = atof(value);
+        else if (MATCH("-d", "--wind-direction"))   opts.windDirection = atof(value);
+        else if (MATCH("-c", "--choppiness"))       opts.choppiness = atof(value);
+        else if (strcmp(arg, "--seed") == 0)        opts.seed = atoi(value);
+        else if (strcmp(arg, "--period") == 0)      opts.period = atof(value);
+        else if (MATCH("-j", "--threads"))          opts.threads = atoi(value);
+        else if (MATCH("-q", "--queries"))          opts.queries = atoi(value);
+        else if (strcmp(arg, "--deform") == 0)      opts.deformPoints = atoi(value);
+        else if (strcmp(arg, "--sweep-choppiness") == 0) opts.choppinessSteps = atoi(value);
+        else if (strcmp(arg, "--cascades") == 0)    opts.cascades = atoi(value);
+        else if (strcmp(arg, "--cascade-ratio") == 0) opts.cascadeRatio = atof(value);
+        else if (strcmp(arg, "--evaluation") == 0) {
+            if (strcmp(value, "auto") == 0)         opts.evaluation = tessendorf::EVAL_AUTO;
+            else if (strcmp(value, "full") == 0)    opts.evaluation = tessendorf::EVAL_FULL_FFT;
+            else if (strcmp(value, "pruned") == 0)  opts.evaluation = tessendorf::EVAL_PRUNED_FFT;
+            else if (strcmp(value, "direct") == 0)  opts.evaluation = tessendorf::EVAL_DIRECT_SUM;
+            else {
+                fprintf(stderr, "unknown evaluation %s\n", value);
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--bake") == 0)        opts.bakeFile = value;
+        else if (strcmp(arg, "--play") == 0)        opts.playFile = value;
+        else if (strcmp(arg, "--trace") == 0)       opts.traceFile = value;
+        else if (strcmp(arg, "--wisdom") == 0) {
+            opts.wisdomFile = value;
+            opts.tune = true;
+        }
+        else {
+            fprintf(stderr, "unknown option %s\n", arg);
+            return false;
+        }
+#undef MATCH
+        i++;
+    }
+
+    if (opts.resolutionX < 2 || opts.resolutionZ < 2 || opts.endFrame < opts.startFrame || opts.fps <= 0. || opts.period <= 0.) {
+        fprintf(stderr, "invalid resolution, frame range, fps or period\n");
+        return false;
+    }
+
+    // Like the node, round the resolution up to sizes the FFT handles quickly.
+    opts.resolutionX = kissfftr2d<float>::fastSize(opts.resolutionX);
+    opts.resolutionZ = kissfftr2d<float>::fastSize(opts.resolutionZ);
+
+    if (opts.cascades < 1 || opts.cascadeRatio <= 1.) {
+        fprintf(stderr, "invalid cascade count or ratio\n");
+        return false;
+    }
+
+    if (opts.loop && !opts.bakeFile) {
+        fprintf(stderr, "--loop needs --bake\n");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Runs the 2D complex-to-real transform on the same random Hermitian spectrum in single precision (with each
+ * FFT backend available on this CPU) and in double precision, and compares the results.
+ * \return false if any single-precision result is further from the double-precision one than float rounding allows
+ */
+static bool checkFft()
+{
+    typedef std::chrono::steady_clock clock;
+    std::vector<const char*> backends = kissfft_batch<float>::backends();
+    const int sizes[][2] = { { 16, 16 }, { 64, 32 }, { 256, 256 }, { 96, 160 }, { 768, 1536 }, { 1024, 1024 }, { 2048, 2048 }, { 21, 14 } };
+    const double tolerance = 1e-5; // Relative to the largest output value.
+    bool ok = true;
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        int rows = sizes[s][0];
+        int cols = sizes[s][1];
+
+        kissfftr2d<double> reference(rows, cols);
+        std::vector<complex> spectrum(reference.spectrumSize());
+        srand(rows * 31 + cols);
+        for (size_t i = 0; i < spectrum.size(); i++) {
+            spectrum[i] = complex(rand() / (double)RAND_MAX - .5, rand() / (double)RAND_MAX - .5);
+        }
+
+        std::vector<complex> expected(spectrum);
+        clock::time_point start = clock::now();
+        reference.transform(&expected[0]);
+        double doubleMs = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+        const double* expectedReal = reinterpret_cast<const double*>(&expected[0]);
+
+        double peak = 0.;
+        for (int m = 0; m < rows; m++) {
+            for (int n = 0; n < cols; n++) {
+                peak = std::max(peak, fabs(expectedReal[m * reference.realStride() + n]));
+            }
+        }
+
+        for (size_t k = 0; k < backends.size(); k++) {
+            kissfft_batch<float>::forceBackend(backends[k]);
+            kissfftr2d<float> fft(rows, cols);
+            kissfft_batch<float>::forceBackend(NULL);
+
+            std::vector<complexf> actual(spectrum.begin(), spectrum.end());
+            start = clock::now();
+            fft.transform(&actual[0]);
+            double floatMs = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+            const float* actualReal = reinterpret_cast<const float*>(&actual[0]);
+
+            double maxError = 0.;
+            for (int m = 0; m < rows; m++) {
+                for (int n = 0; n < cols; n++) {
+                    int i = m * reference.realStride() + n;
+                    maxError = std::max(maxError, fabs(actualReal[i] - expectedReal[i]));
+                }
+            }
+
+            double relative = maxError / peak;
+            bool pass = relative <= tolerance;
+            ok = ok && pass;
+            printf("%4dx%-4d %-13s relative error %.3g %s, float %.3f ms, double %.3f ms\n",
+                   rows, cols, backends[k], relative, pass ? "ok" : "FAIL", floatMs, doubleMs);
+        }
+    }
+
+    return ok;
+}
+
+/**
+ * Creates the simulation of the given frame.
+ */
+static tessendorf makeSimulation(const simOptions& opts, const vector3& dirVector, int frame)
+{
+    tessendorf simulation(opts.amplitude, opts.windSpeed, dirVector, opts.choppiness, frame / opts.fps,
+                          opts.resolutionX, opts.resolutionZ, opts.planeSize, opts.planeSize,
+                          opts.waveSizeFilter, opts.seed);
+    simulation.setThreadCount(opts.threads);
+    simulation.setPeriod(opts.period);
+    simulation.setIncremental(opts.incremental);
+    simulation.setEvaluation(opts.evaluation);
+    simulation.setPrecision(opts.precision);
+    return simulation;
+}
+
+/**
+ * Simulates the last frame, with normals and Jacobians, in single and in double precision at several resolutions
+ * and with each evaluation path, and compares the results. The direct sum is only checked at small resolutions,
+ * where it is fast enough.
+ * \return false if any single-precision result is further from the double-precision one than the bounds allow
+ */
+static bool checkPrecision(const simOptions& opts, const vector3& dirVector)
+{
+    typedef std::chrono::steady_clock clock;
+    const int sizes[][2] = { { 64, 64 }, { 256, 256 }, { 160, 96 }, { 1024, 1024 } }; // X by Z.
+    const tessendorf::evaluation paths[] = { tessendorf::EVAL_FULL_FFT, tessendorf::EVAL_PRUNED_FFT, tessendorf::EVAL_DIRECT_SUM };
+    const double heightTolerance = 1e-5;   // Relative to the peak height.
+    const double positionTolerance = 1e-6; // Horizontal, relative to the plane size.
+    const double normalTolerance = 1e-3;   // Largest difference of a normal's components; steep near folds.
+    const double jacobianTolerance = 1e-4;
+    bool ok = true;
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (size_t p = 0; p < sizeof(paths) / sizeof(paths[0]); p++) {
+            if (paths[p] == tessendorf::EVAL_DIRECT_SUM && sizes[s][0] * sizes[s][1] > 128 * 128) {
+                continue;
+            }
+            simOptions config = opts;
+            config.resolutionX = sizes[s][0];
+            config.resolutionZ = sizes[s][1];
+            config.evaluation = paths[p];
+            config.incremental = false;
+            size_t vertices = (size_t)config.resolutionX * config.resolutionZ;
+
+            floatPointArray points[2] = { floatPointArray(vertices), floatPointArray(vertices) };
+            std::vector<float> normals[2] = { std::vector<float>(3 * vertices), std::vector<float>(3 * vertices) };
+            std::vector<float> jacobians[2] = { std::vector<float>(vertices), std::vector<float>(vertices) };
+            double ms[2];
+            for (int d = 0; d < 2; d++) {
+                config.precision = d ? tessendorf::PRECISION_DOUBLE : tessendorf::PRECISION_SINGLE;
+                oceanWorkspace workspace;
+                clock::time_point start = clock::now();
+                makeSimulation(config, dirVector, opts.endFrame).simulate(workspace, &points[d][0].x,
+                                                                          sizeof(floatPoint) / sizeof(float),
+                                                                          &normals[d][0], &jacobians[d][0]);
+                ms[d] = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+            }
+
+            double peak = 0.;
+            double heightError = 0.;
+            double positionError = 0.;
+            double normalError = 0.;
+            double jacobianError = 0.;
+            for (size_t i = 0; i < vertices; i++) {
+                const floatPoint& single = points[0][i];
+                const floatPoint& reference = points[1][i];
+                peak = std::max(peak, (double)fabs(reference.y));
+                positionError = std::max(positionError, (double)fabs(single.x - reference.x));
+                heightError = std::max(heightError, (double)fabs(single.y - reference.y));
+                positionError = std::max(positionError, (double)fabs(single.z - reference.z));
+                for (int c = 0; c < 3; c++) {
+                    normalError = std::max(normalError, (double)fabs(normals[0][3 * i + c] - normals[1][3 * i + c]));
+                }
+                jacobianError = std::max(jacobianError, (double)fabs(jacobians[0][i] - jacobians[1][i]));
+            }
+
+            double relativeHeight = peak > 0. ? heightError / peak : heightError;
+            double relativePosition = positionError / config.planeSize;
+            bool pass = relativeHeight <= heightTolerance && relativePosition <= positionTolerance
+                && normalError <= normalTolerance && jacobianError <= jacobianTolerance;
+            ok = ok && pass;
+            printf("%4dx%-4d %-10s errors: heights %.3g of peak, x and z %.3g of plane size, normals %.3g, "
+                   "Jacobians %.3g %s, single %.3f ms, double %.3f ms\n", config.resolutionX, config.resolutionZ,
+                   tessendorf::evaluationName(paths[p]), relativeHeight, relativePosition, normalError,
+                   jacobianError, pass ? "ok" : "FAIL", ms[0], ms[1]);
+        }
+    }
+
+    return ok;
+}
+
+/**
+ * Prints the plane size and wavevector band of each cascade.
+ */
+static void printCascades(const simOptions& opts, const tessendorf& simulation)
+{
+    for (int i = 0; i < opts.cascades; i++) {
+        tessendorf cascade = simulation.cascade(i, opts.cascades, opts.cascadeRatio);
+        if (i == opts.cascades - 1) {
+            printf("cascade %d: %g m, |k| >= %.4g rad/m\n", i, cascade.sizeX(), cascade.bandMin());
+        } else {
+            printf("cascade %d: %g m, %.4g <= |k| < %.4g rad/m\n", i, cascade.sizeX(), cascade.bandMin(),
+                   cascade.bandMax());
+        }
+    }
+}
+
+/**
+ * Gets the RMS of the heights of a simulation's fields.
+ */
+static double heightRms(const tessendorf& simulation)
+{
+    oceanWorkspace workspace;
+    size_t samples = (size_t)simulation.rows() * simulation.cols();
+    std::vector<float> fields(3 * samples);
+    tessendorf copy(simulation);
+    copy.simulateFields(workspace, &fields[0]);
+
+    double sum = 0.;
+    for (size_t i = 0; i < samples; i++) {
+        sum += (double)fields[3 * i + 1] * fields[3 * i + 1];
+    }
+    return sqrt(sum / samples);
+}
+
+/**
+ * Checks that the cascades hold the energy of the ocean they stand for: the height RMS of each cascade's band at
+ * the last frame is compared with the same band of one grid that has the plane size of the first cascade and the
+ * resolution of the last. The grids draw different random numbers, so the RMS only agrees statistically.
+ * \return false if a band's RMS is off by more than the tolerance, or the large grid can't be built
+ */
+static bool checkCascades(const simOptions& opts, const vector3& dirVector)
+{
+    const double tolerance = 0.25; // Relative difference of the RMS.
+    double scale = pow(opts.cascadeRatio, opts.cascades - 1);
+    double largeX = opts.resolutionX * scale;
+    double largeZ = opts.resolutionZ * scale;
+    if (opts.cascades < 2 || largeX != floor(largeX) || largeZ != floor(largeZ) || largeX * largeZ > 4096. * 4096.) {
+        fprintf(stderr, "--check-cascades needs at least 2 cascades, a whole ratio, and at most 4096 x 4096 "
+                "vertices for all the cascades together\n");
+        return false;
+    }
+
+    tessendorf simulation = makeSimulation(opts, dirVector, opts.endFrame);
+    simOptions large = opts;
+    large.resolutionX = (int)largeX;
+    large.resolutionZ = (int)largeZ;
+    large.evaluation = tessendorf::EVAL_AUTO;
+    bool ok = true;
+
+    printCascades(opts, simulation);
+    for (int i = 0; i < opts.cascades; i++) {
+        tessendorf cascade = simulation.cascade(i, opts.cascades, opts.cascadeRatio);
+        tessendorf band = makeSimulation(large, dirVector, opts.endFrame);
+        band.setBand(cascade.bandMin(), cascade.bandMax());
+
+        double cascadeRms = heightRms(cascade);
+        double bandRms = heightRms(band);
+        double relative = bandRms > 0. ? fabs(cascadeRms - bandRms) / bandRms : 0.;
+        bool pass = relative <= tolerance;
+        ok = ok && pass;
+        printf("cascade %d: height RMS %.4g, %dx%d grid over the same band %.4g, difference %.1f%% %s\n", i,
+               cascadeRms, large.resolutionX, large.resolutionZ, bandRms, 100. * relative, pass ? "ok" : "FAIL");
+    }
+
+    return ok;
+}
+
+/**
+ * Times a batch of point queries at the given frame, and checks them against the frame's mesh: querying at the
+ * (x, z) of each displaced vertex should give back its height. The mesh only holds the first cascade, so with
+ * several cascades the check is skipped.
+ */
+static void runQueries(const simOptions& opts, const vector3& dirVector, int frame, const floatPointArray& mesh)
+{
+    typedef std::chrono::steady_clock clock;
+
+    tessendorf simulation = makeSimulation(opts, dirVector, frame);
+    oceanWorkspace workspace;
+    oceanSampler sampler;
+    sampler.setFilter(opts.filter);
+    sampler.setThreadCount(opts.threads);
+
+    clock::time_point start = clock::now();
+    sampler.update(simulation, workspace, opts.cascades, opts.cascadeRatio);
+    double updateMs = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+    std::vector<float> positions(3 * (size_t)opts.queries);
+    srand(opts.seed);
+    for (size_t i = 0; i < positions.size(); i++) {
+        positions[i] = (float)((rand() / (double)RAND_MAX - .5) * 2. * opts.planeSize);
+    }
+
+    std::vector<float> heights(opts.queries);
+    std::vector<float> displacements(3 * (size_t)opts.queries);
+    std::vector<float> normals(3 * (size_t)opts.queries);
+    oceanQuery q;
+    q.count = opts.queries;
+    q.positions = &positions[0];
+    q.heights = &heights[0];
+    q.displacements = &displacements[0];
+    q.normals = &normals[0];
+
+    start = clock::now();
+    sampler.query(q);
+    double queryMs = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+    double checksum = 0.;
+    for (int i = 0; i < opts.queries; i++) {
+        checksum += heights[i] + normals[3 * i + 1];
+    }
+
+    printf("%d %s queries at frame %d: %.3f ms (%.1f M/s), field update %.3f ms, checksum %.9g\n",
+           opts.queries, opts.filter == oceanSampler::BICUBIC ? "bicubic" : "bilinear", frame, queryMs,
+           opts.queries / (queryMs * 1000.), updateMs, checksum);
+
+    if (opts.cascades > 1) {
+        printCascades(opts, simulation);
+        return;
+    }
+
+    // Query at every displaced vertex of the mesh.
+    std::vector<float> meshHeights(mesh.size());
+    oceanQuery check;
+    check.count = mesh.size();
+    check.positions = &mesh[0].x;
+    check.stride = sizeof(floatPoint) / sizeof(float);
+    check.heights = &meshHeights[0];
+    sampler.query(check);
+
+    double maxError = 0.;
+    double peak = 0.;
+    for (size_t i = 0; i < mesh.size(); i++) {
+        maxError = std::max(maxError, (double)fabs(meshHeights[i] - mesh[i].y));
+        peak = std::max(peak, (double)fabs(mesh[i].y));
+    }
+
+    printf("height at mesh vertices: max error %.3g (%.3g of peak height)\n", maxError, peak > 0. ? maxError / peak : 0.);
+}
+
+/**
+ * Deforms points the way the tessendorfOceanDeformer node does: each point moves by the displacement sampled at
+ * its own (x, z). Checks that deforming the rest positions of the grid reproduces the frame's mesh (with a single
+ * cascade), then times deforming random points.
+ */
+static void runDeform(const simOptions& opts, const vector3& dirVector, int frame, const floatPointArray& mesh)
+{
+    typedef std::chrono::steady_clock clock;
+
+    tessendorf simulation = makeSimulation(opts, dirVector, frame);
+    oceanWorkspace workspace;
+    oceanSampler sampler;
+    sampler.setFilter(opts.filter);
+    sampler.setIterations(0);
+    sampler.setThreadCount(opts.threads);
+    sampler.update(simulation, workspace, opts.cascades, opts.cascadeRatio);
+
+    // The rest positions of the grid, as laid out by tessendorf::simulate.
+    int M = opts.resolutionZ;
+    int N = opts.resolutionX;
+    std::vector<float> grid(3 * mesh.size());
+    for (int m = 0; m < M; m++) {
+        for (int n = 0; n < N; n++) {
+            float* p = &grid[3 * (m * N + n)];
+            p[0] = (float)((n - N / 2) * opts.planeSize / N);
+            p[1] = 0.f;
+            p[2] = (float)((m - M / 2) * opts.planeSize / M);
+        }
+    }
+
+    std::vector<float> displacements(grid.size());
+    oceanQuery q;
+    q.count = mesh.size();
+    q.positions = &grid[0];
+    q.displacements = &displacements[0];
+    sampler.query(q);
+
+    double maxError = 0.;
+    for (size_t i = 0; i < mesh.size(); i++) {
+        maxError = std::max(maxError, (double)fabs(grid[3 * i] + displacements[3 * i] - mesh[i].x));
+        maxError = std::max(maxError, (double)fabs(grid[3 * i + 1] + displacements[3 * i + 1] - mesh[i].y));
+        maxError = std::max(maxError, (double)fabs(grid[3 * i + 2] + displacements[3 * i + 2] - mesh[i].z));
+    }
+
+    // Random points over a few repeats of the plane, as an irregular mesh would have.
+    std::vector<float> points(3 * (size_t)opts.deformPoints);
+    srand(opts.seed + 1);
+    for (size_t i = 0; i < points.size(); i++) {
+        points[i] = (float)((rand() / (double)RAND_MAX - .5) * 2. * opts.planeSize);
+    }
+    displacements.resize(points.size());
+    q.count = opts.deformPoints;
+    q.positions = &points[0];
+    q.displacements = &displacements[0];
+
+    clock::time_point start = clock::now();
+    sampler.query(q);
+    for (size_t i = 0; i < points.size(); i++) {
+        points[i] += displacements[i];
+    }
+    double ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+    double checksum = 0.;
+    for (int i = 0; i < opts.deformPoints; i++) {
+        checksum += points[3 * i + 1];
+    }
+
+    printf("deformed %d %s points at frame %d: %.3f ms (%.1f M/s), checksum %.9g\n", opts.deformPoints,
+           opts.filter == oceanSampler::BICUBIC ? "bicubic" : "bilinear", frame, ms,
+           opts.deformPoints / (ms * 1000.), checksum);
+    if (opts.cascades > 1) {
+        printCascades(opts, simulation);
+    } else {
+        printf("deformed grid vs mesh: max error %.3g\n", maxError);
+    }
+}
+
+/**
+ * Re-simulates the given frame at a series of choppiness values in one workspace, as the node does while the
+ * choppiness slider is dragged. Only the first step runs the FFTs; the others reuse the fields left in the
+ * workspace and just rescale the displacement. Checks the last step against a simulation in a fresh workspace.
+ */
+static void runChoppinessSweep(const simOptions& opts, const vector3& dirVector, int frame)
+{
+    typedef std::chrono::steady_clock clock;
+
+    oceanWorkspace workspace;
+    floatPointArray points((size_t)opts.resolutionX * opts.resolutionZ);
+    const size_t stride = sizeof(floatPoint) / sizeof(float);
+    simOptions step = opts;
+
+    double firstMs = 0.;
+    double restMs = 0.;
+    for (int i = 0; i < opts.choppinessSteps; i++) {
+        step.choppiness = opts.choppinessSteps > 1 ? 2. * i / (opts.choppinessSteps - 1) : opts.choppiness;
+
+        clock::time_point start = clock::now();
+        tessendorf simulation = makeSimulation(step, dirVector, frame);
+        simulation.simulate(workspace, &points[0].x, stride);
+        double ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+        (i == 0 ? firstMs : restMs) += ms;
+    }
+
+    oceanWorkspace fresh;
+    floatPointArray expected(points.size());
+    makeSimulation(step, dirVector, frame).simulate(fresh, &expected[0].x, stride);
+    bool identical = memcmp(&points[0].x, &expected[0].x, points.size() * sizeof(floatPoint)) == 0;
+
+    printf("choppiness sweep at frame %d: first step %.3f ms, %d more steps %.3f ms each, %s fresh simulation\n",
+           frame, firstMs, opts.choppinessSteps - 1, opts.choppinessSteps > 1 ? restMs / (opts.choppinessSteps - 1) : 0.,
+           identical ? "identical to" : "DIFFERENT from");
+}
+
+/**
+ * Times the Maya-independent part of the node's mesh: building the topology for the resolution, and simulating
+ * the given frame into the point buffer, which is then checked against the frame simulated by the main loop.
+ */
+static void runMesh(const simOptions& opts, const vector3& dirVector, int frame, const floatPointArray& expected)
+{
+    typedef std::chrono::steady_clock clock;
+
+    oceanMesh mesh;
+    clock::time_point start = clock::now();
+    mesh.resize(opts.resolutionX, opts.resolutionZ, opts.threads);
+    double topologyMs = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+    // As in the node's playback, where the topology is kept and only the points change.
+    oceanWorkspace workspace;
+    makeSimulation(opts, dirVector, frame - 1).simulate(workspace, mesh.points(), 4);
+    start = clock::now();
+    bool rebuilt = mesh.resize(opts.resolutionX, opts.resolutionZ, opts.threads);
+    makeSimulation(opts, dirVector, frame).simulate(workspace, mesh.points(), 4);
+    double pointsMs = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+    double maxError = 0.;
+    const float* points = mesh.points();
+    for (int i = 0; i < mesh.vertexCount(); i++) {
+        maxError = std::max(maxError, (double)fabs(points[4 * i] - expected[i].x));
+        maxError = std::max(maxError, (double)fabs(points[4 * i + 1] - expected[i].y));
+        maxError = std::max(maxError, (double)fabs(points[4 * i + 2] - expected[i].z));
+        maxError = points[4 * i + 3] == 1.f ? maxError : INFINITY;
+    }
+
+    printf("mesh topology %dx%d (%d quads): built in %.3f ms%s; frame %d into the point buffer %.3f ms, max error %.3g\n",
+           opts.resolutionX, opts.resolutionZ, mesh.faceCount(), topologyMs, rebuilt ? ", REBUILT for the same size" : "",
+           frame, pointsMs, maxError);
+}
+
+/**
+ * Checks analytic normals against normals estimated by central differences of the displaced mesh, and reports how
+ * much of the surface folds over (negative Jacobian).
+ */
+static void checkNormals(const simOptions& opts, int frame, const floatPointArray& mesh, const std::vector<float>& normals,
+                         const std::vector<float>& jacobians)
+{
+    int M = opts.resolutionZ;
+    int N = opts.resolutionX;
+    double sumAngle = 0.;
+    double maxAngle = 0.;
+    int count = 0;
+
+    // Edge vertices have no neighbour on one side, so only interior vertices are compared.
+    for (int m = 1; m < M - 1; m++) {
+        for (int n = 1; n < N - 1; n++) {
+            const floatPoint& left = mesh[m * N + n - 1];
+            const floatPoint& right = mesh[m * N + n + 1];
+            const floatPoint& back = mesh[(m - 1) * N + n];
+            const floatPoint& front = mesh[(m + 1) * N + n];
+            vector3 a(front.x - back.x, front.y - back.y, front.z - back.z);
+            vector3 b(right.x - left.x, right.y - left.y, right.z - left.z);
+            vector3 estimate = vector3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x).normal();
+
+            const float* normal = &normals[3 * (m * N + n)];
+            double cosine = estimate.x * normal[0] + estimate.y * normal[1] + estimate.z * normal[2];
+            double angle = acos(std::max(-1., std::min(1., cosine))) * 180. / M_PI;
+            sumAngle += angle;
+            maxAngle = std::max(maxAngle, angle);
+            count++;
+        }
+    }
+
+    double minJacobian = jacobians[0];
+    size_t folded = 0;
+    for (size_t i = 0; i < jacobians.size(); i++) {
+        minJacobian = std::min(minJacobian, (double)jacobians[i]);
+        folded += jacobians[i] < 0.f;
+    }
+
+    printf("normals at frame %d vs mesh differences: mean %.3g deg, max %.3g deg\n", frame,
+           count ? sumAngle / count : 0., maxAngle);
+    printf("jacobian: min %.4g, %.2f%% of vertices folded\n", minJacobian, 100. * folded / jacobians.size());
+}
+
+int main(int argc, char** argv)
+{
+    simOptions opts;
+    if (!parseOptions(argc, argv, opts)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    
+    if (opts.checkFft) {
+        return checkFft() ? 0 : 1;
+    }
+
+    if (opts.tune) {
+        kissfft_wisdom::enable(opts.wisdomFile ? opts.wisdomFile : kissfft_wisdom::defaultPath());
+    }
+
+    double dirRadians = opts.windDirection * M_PI / 180.;
+    vector3 dirVector(cos(dirRadians), 0., sin(dirRadians));
+
+    if (opts.checkPrecision) {
+        return checkPrecision(opts, dirVector) ? 0 : 1;
+    }
+
+    if (opts.checkCascades) {
+        return checkCascades(opts, dirVector) ? 0 : 1;
+    }
+
+    typedef std::chrono::steady_clock clock;
+    double totalMs = 0.;
+    double minMs = 0.;
+    double maxMs = 0.;
+    double checksum = 0.;
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a over the output, to compare runs bit for bit.
+    int frames = 0;
+
+    int bakedFrames = 0;
+    int pathFrames[tessendorf::EVAL_REUSED + 1] = { 0 }; // Simulated frames per evaluation path.
+    size_t activeWaves = 0;
+
+    // Like the node, keep one workspace and output buffer for the whole run.
+    oceanWorkspace workspace;
+    floatPointArray result((size_t)opts.resolutionX * opts.resolutionZ);
+    std::vector<float> normals(opts.normals ? 3 * result.size() : 0);
+    std::vector<float> jacobians(opts.normals ? result.size() : 0);
+    bool normalsCurrent = false; // Whether the normals belong to the last frame (baked frames have none).
+
+    oceanBakeParams params = { opts.amplitude, opts.windSpeed, dirVector.x, dirVector.z, opts.choppiness,
+                               opts.planeSize, opts.planeSize, opts.waveSizeFilter,
+                               opts.resolutionX, opts.resolutionZ, opts.seed, opts.precision, opts.period };
+
+    oceanBakeWriter writer;
+    if (opts.bakeFile && opts.loop) {
+        if (!writer.openLoop(opts.bakeFile, params, opts.fps)) {
+            fprintf(stderr, "can't create %s, or the period isn't a whole number of frames\n", opts.bakeFile);
+            return 1;
+        }
+        opts.startFrame = 0;
+        opts.endFrame = writer.frameCount() - 1;
+    } else if (opts.bakeFile && !writer.open(opts.bakeFile, params, opts.fps, opts.startFrame, opts.endFrame - opts.startFrame + 1)) {
+        fprintf(stderr, "can't create %s\n", opts.bakeFile);
+        return 1;
+    }
+
+    // Each simulated frame is profiled on its own, like an evaluation of the node.
+    oceanProfile profile;
+    oceanTrace trace;
+    bool profiled = opts.stats || opts.traceFile;
+    if (opts.traceFile && !trace.open(opts.traceFile)) {
+        fprintf(stderr, "can't create %s\n", opts.traceFile);
+        return 1;
+    }
+
+    // Playback takes frames from the bake only if it was made with the same options, as the node does.
+    oceanBakeReader reader;
+    if (opts.playFile) {
+        if (!reader.open(opts.playFile)) {
+            fprintf(stderr, "can't read bake file %s\n", opts.playFile);
+            return 1;
+        }
+        if (reader.header().params != params) {
+            fprintf(stderr, "%s was baked with different options; simulating instead\n", opts.playFile);
+            reader.close();
+        }
+    }
+
+    for (int frame = opts.startFrame; frame <= opts.endFrame; frame++) {
+        double seconds = frame / opts.fps;
+        int path = -1;
+
+        clock::time_point start = clock::now();
+        int bakedIndex = reader.frameIndex(seconds);
+        if (bakedIndex >= 0) {
+            const float* points = reader.frame(bakedIndex);
+            memcpy(&result[0].x, points, result.size() * sizeof(floatPoint));
+            bakedFrames++;
+            normalsCurrent = false;
+        } else {
+            tessendorf simulation = makeSimulation(opts, dirVector, frame);
+            if (profiled) {
+                profile.reset();
+                simulation.setProfile(&profile);
+            }
+            simulation.simulate(workspace, &result[0].x, sizeof(floatPoint) / sizeof(float),
+                                opts.normals ? &normals[0] : NULL, opts.normals ? &jacobians[0] : NULL);
+            trace.write(profile, "oceanSim");
+            normalsCurrent = opts.normals;
+            path = simulation.lastEvaluation();
+            activeWaves = simulation.lastActiveWaveCount();
+            pathFrames[path]++;
+        }
+        double ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+        if (opts.bakeFile && !writer.writeFrame(&result[0].x, sizeof(floatPoint) / sizeof(float))) {
+            fprintf(stderr, "error writing %s\n", opts.bakeFile);
+            return 1;
+        }
+
+        // Sum the heights so that the work can't be optimized away, and so that runs can be compared.
+        for (size_t i = 0; i < result.size(); i++) {
+            checksum += result[i].y;
+        }
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&result[0]);
+        for (size_t i = 0; i < result.size() * sizeof(floatPoint); i++) {
+            hash = (hash ^ bytes[i]) * 1099511628211ULL;
+        }
+
+        if (opts.verbose && path >= 0) {
+            printf("frame %d: %.3f ms, %s, %zu active waves\n", frame, ms,
+                   tessendorf::evaluationName((tessendorf::evaluation)path), activeWaves);
+        } else if (opts.verbose) {
+            printf("frame %d: %.3f ms\n", frame, ms);
+        }
+
+        totalMs += ms;
+        minMs = frames == 0 || ms < minMs ? ms : minMs;
+        maxMs = frames == 0 || ms > maxMs ? ms : maxMs;
+        frames++;
+    }
+
+    printf("resolution %dx%d, %d threads, %d frames: total %.3f ms, mean %.3f ms, min %.3f ms, max %.3f ms (%.2f fps)\n",
+           opts.resolutionX, opts.resolutionZ, threadPool::resolveThreads(opts.threads), frames, totalMs, totalMs / frames, minMs, maxMs,
+           frames * 1000. / totalMs);
+    printf("height checksum %.9g, output hash %016llx, workspace %.1f MB\n", checksum, (unsigned long long)hash,
+           workspace.bytes() / (1024. * 1024.));
+    if (bakedFrames < frames && opts.precision == tessendorf::PRECISION_DOUBLE) {
+        printf("fft: double precision, rows of %d by %s, columns of %d by %s\n", opts.resolutionX / 2,
+               workspace.fft<double>().rowTransform().backend(), opts.resolutionZ,
+               workspace.fft<double>().columnTransform().backend());
+    } else if (bakedFrames < frames) {
+        const kissfft_batch<float>& rows = workspace.fft().rowTransform();
+        const kissfft_batch<float>& columns = workspace.fft().columnTransform();
+        printf("fft: rows of %d by %s%s, columns of %d by %s%s\n", opts.resolutionX / 2, rows.backend(),
+               rows.fixedLength() ? " (fixed length)" : "", opts.resolutionZ, columns.backend(),
+               columns.fixedLength() ? " (fixed length)" : "");
+    }
+
+    if (opts.stats && bakedFrames < frames) {
+        printf("stats of the last simulated frame: %s\n", profile.json().c_str());
+    }
+    trace.close();
+
+    if (bakedFrames < frames) {
+        printf("evaluation:");
+        for (int path = tessendorf::EVAL_FULL_FFT; path <= tessendorf::EVAL_REUSED; path++) {
+            if (pathFrames[path] > 0) {
+                printf(" %s %d frames,", tessendorf::evaluationName((tessendorf::evaluation)path), pathFrames[path]);
+            }
+        }
+        printf(" %zu of %d active waves\n", activeWaves, opts.resolutionZ * (opts.resolutionX / 2 + 1));
+    }
+
+    if (pathFrames[tessendorf::EVAL_PRUNED_FFT] + pathFrames[tessendorf::EVAL_DIRECT_SUM] > 0 && !opts.incremental) {
+        // The last frame again, through the full FFT.
+        simOptions full = opts;
+        full.evaluation = tessendorf::EVAL_FULL_FFT;
+        oceanWorkspace fresh;
+        floatPointArray expected(result.size());
+        makeSimulation(full, dirVector, opts.endFrame).simulate(fresh, &expected[0].x, sizeof(floatPoint) / sizeof(float));
+
+        double maxError = 0.;
+        double peak = 0.;
+        for (size_t i = 0; i < result.size(); i++) {
+            maxError = std::max(maxError, (double)fabs(result[i].x - expected[i].x));
+            maxError = std::max(maxError, (double)fabs(result[i].y - expected[i].y));
+            maxError = std::max(maxError, (double)fabs(result[i].z - expected[i].z));
+            peak = std::max(peak, (double)fabs(expected[i].y));
+        }
+        printf("sparse evaluation vs full FFT at frame %d: max error %.3g (%.3g of peak height)\n",
+               opts.endFrame, maxError, peak > 0. ? maxError / peak : 0.);
+    }
+
+    if (opts.incremental && bakedFrames < frames) {
+        // Direct evaluation of the last frame, in a fresh workspace.
+        simOptions direct = opts;
+        direct.incremental = false;
+        oceanWorkspace fresh;
+        floatPointArray expected(result.size());
+        makeSimulation(direct, dirVector, opts.endFrame).simulate(fresh, &expected[0].x, sizeof(floatPoint) / sizeof(float));
+
+        double maxError = 0.;
+        double peak = 0.;
+        for (size_t i = 0; i < result.size(); i++) {
+            maxError = std::max(maxError, (double)fabs(result[i].x - expected[i].x));
+            maxError = std::max(maxError, (double)fabs(result[i].y - expected[i].y));
+            maxError = std::max(maxError, (double)fabs(result[i].z - expected[i].z));
+            peak = std::max(peak, (double)fabs(expected[i].y));
+        }
+        printf("incremental phases vs direct evaluation at frame %d: max error %.3g (%.3g of peak height)\n",
+               opts.endFrame, maxError, peak > 0. ? maxError / peak : 0.);
+    }
+
+    if (opts.precision == tessendorf::PRECISION_DOUBLE && bakedFrames < frames) {
+        // The last frame again, in single precision.
+        simOptions single = opts;
+        single.precision = tessendorf::PRECISION_SINGLE;
+        oceanWorkspace fresh;
+        floatPointArray expected(result.size());
+        makeSimulation(single, dirVector, opts.endFrame).simulate(fresh, &expected[0].x, sizeof(floatPoint) / sizeof(float));
+
+        double maxError = 0.;
+        double peak = 0.;
+        for (size_t i = 0; i < result.size(); i++) {
+            maxError = std::max(maxError, (double)fabs(result[i].y - expected[i].y));
+            peak = std::max(peak, (double)fabs(result[i].y));
+        }
+        printf("single vs double precision at frame %d: max height error %.3g (%.3g of peak height)\n",
+               opts.endFrame, maxError, peak > 0. ? maxError / peak : 0.);
+    }
+
+    if (normalsCurrent) {
+        checkNormals(opts, opts.endFrame, result, normals, jacobians);
+    }
+
+    if (opts.mesh) {
+        runMesh(opts, dirVector, opts.endFrame, result);
+    }
+
+    if (opts.choppinessSteps > 0) {
+        runChoppinessSweep(opts, dirVector, opts.endFrame);
+    }
+
+    if (opts.queries > 0) {
+        runQueries(opts, dirVector, opts.endFrame, result);
+    }
+
+    if (opts.deformPoints > 0) {
+        runDeform(opts, dirVector, opts.endFrame, result);
+    }
+
+    if (opts.playFile) {
+        printf("%d of %d frames played back from %s\n", bakedFrames, frames, opts.playFile);
+    }
+
+    if (opts.bakeFile) {
+        if (!writer.close()) {
+            fprintf(stderr, "error writing %s\n", opts.bakeFile);
+            return 1;
+        }
+        printf("baked %d frames to %s\n", frames, opts.bakeFile);
+    }
+
+    return 0;
+}
@@ -0,0 +1,62 @@
+//
+//  oceanTypes.h
+//  TessendorfOceanNode
+//
+//  Plain vector and point types used by the simulation core, so that the core can be
+//  built and run without the Maya SDK.
+//
+
+#ifndef __TessendorfOceanNode__oceanTypes__
+#define __TessendorfOceanNode__oceanTypes__
+
+#include <cmath>
+#include <vector>
+
+/**
+ * A three-component double-precision vector; a Maya-free stand-in for MVector.
+ */
+struct vector3 {
+    double x;
+    double y;
+    double z;
+
+    vector3() : x(0.), y(0.), z(0.) {}
+    vector3(double xx, double yy, double zz) : x(xx), y(yy), z(zz) {}
+
+    /**
+     * Gets the length (magnitude) of the vector.
+     */
+    double length() const { return sqrt(x * x + y * y + z * z); }
+
+    /**
+     * Gets a unit vector in the direction of this vector, or the zero vector if this vector has zero length.
+     */
+    vector3 normal() const
+    {
+        double len = length();
+        return len > 0. ? vector3(x / len, y / len, z / len) : vector3();
+    }
+
+    vector3 operator-() const { return vector3(-x, -y, -z); }
+
+    /**
+     * Dot product (matches the MVector convention of operator*).
+     */
+    double operator*(const vector3& other) const { return x * other.x + y * other.y + z * other.z; }
+};
+
+/**
+ * A three-component single-precision point; a Maya-free stand-in for MFloatPoint.
+ */
+struct floatPoint {
+    float x;
+    float y;
+    float z;
+
+    floatPoint() : x(0.f), y(0.f), z(0.f) {}
+    floatPoint(float xx, float yy, float zz) : x(xx), y(yy), z(zz) {}
+};
+
+typedef std::vector<floatPoint> floatPointArray;
+
+#endif /* defined(__TessendorfOceanNode__oceanTypes__) */
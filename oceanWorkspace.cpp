@@ -0,0 +1,128 @@
+//
+//  oceanWorkspace.cpp
+//  TessendorfOceanNode
+//
+
+#include "oceanWorkspace.h"
+
+oceanWorkspace::oceanWorkspace()
+    : M(0), N(0), workers(0), scratchSize(0), tablesLx(0.), tablesLz(0.), tablesPeriod(0.), hasTables(false),
+      hasContents(false)
+{
+    phases.valid = phases.stepValid = false;
+    phases.time = phases.step = 0.;
+    phases.advances = 0;
+    phases.sparse = false;
+}
+
+template <typename Scalar>
+void oceanWorkspace::gridSet<Scalar>::release()
+{
+    plan.reset();
+    for (int g = 0; g < GRID_COUNT; g++) {
+        grids[g].resize(0);
+    }
+    scratch.resize(0);
+}
+
+template <typename Scalar>
+size_t oceanWorkspace::gridSet<Scalar>::bytes() const
+{
+    size_t total = scratch.bytes();
+    for (int g = 0; g < GRID_COUNT; g++) {
+        total += grids[g].bytes();
+    }
+    return total;
+}
+
+template <typename Scalar>
+bool oceanWorkspace::prepare(int rows, int cols, int threads, bool derivatives)
+{
+    gridSet<Scalar>& set = gridsFor<Scalar>();
+    bool resized = rows != M || cols != N;
+    bool changed = false;
+    
+    if (!set.plan || resized) {
+        // Only one scalar type is kept, so switching precision doesn't double the memory.
+        singleGrids.release();
+        doubleGrids.release();
+        set.plan.reset(new kissfftr2d<Scalar>(rows, cols));
+        for (int g = 0; g < GRID_COUNT; g++) {
+            set.grids[g].resize(g < FIELD_GRID_COUNT ? set.plan->spectrumSize() : 0);
+        }
+        hasContents = false;
+        changed = true;
+    }
+    
+    if (resized) {
+        M = rows;
+        N = cols;
+        for (int t = 0; t < TABLE_COUNT; t++) {
+            tables[t].resize(tableSize());
+        }
+        for (int t = 0; t < PHASE_TABLE_COUNT; t++) {
+            phaseTables[t].resize(0);
+        }
+        hasTables = false;
+        phases.valid = phases.stepValid = false;
+    }
+    
+    if (derivatives && set.grids[SLOPE_X].size() != set.plan->spectrumSize()) {
+        for (int g = FIELD_GRID_COUNT; g < GRID_COUNT; g++) {
+            set.grids[g].resize(set.plan->spectrumSize());
+        }
+        changed = true;
+    }
+    
+    if (changed || threads != workers) {
+        workers = threads;
+        scratchSize = set.plan->scratchSize();
+        set.scratch.resize(workers * scratchSize);
+        changed = true;
+    }
+    
+    return changed;
+}
+
+template bool oceanWorkspace::prepare<float>(int rows, int cols, int threads, bool derivatives);
+template bool oceanWorkspace::prepare<double>(int rows, int cols, int threads, bool derivatives);
+
+void oceanWorkspace::release()
+{
+    singleGrids.release();
+    doubleGrids.release();
+    for (int t = 0; t < TABLE_COUNT; t++) {
+        tables[t].resize(0);
+    }
+    for (int t = 0; t < PHASE_TABLE_COUNT; t++) {
+        phaseTables[t].resize(0);
+    }
+    hasTables = false;
+    phases.valid = phases.stepValid = false;
+    std::vector<int>().swap(active);
+    hasContents = false;
+    M = N = workers = 0;
+    scratchSize = 0;
+}
+
+void oceanWorkspace::preparePhaseTables()
+{
+    for (int t = 0; t < PHASE_TABLE_COUNT; t++) {
+        if (phaseTables[t].size() != tableSize()) {
+            phaseTables[t].resize(tableSize());
+            phases.valid = phases.stepValid = false;
+        }
+    }
+}
+
+size_t oceanWorkspace::bytes() const
+{
+    size_t total = singleGrids.bytes() + doubleGrids.bytes();
+    for (int t = 0; t < TABLE_COUNT; t++) {
+        total += tables[t].bytes();
+    }
+    for (int t = 0; t < PHASE_TABLE_COUNT; t++) {
+        total += phaseTables[t].bytes();
+    }
+    return total;
+}
@@ -0,0 +1,279 @@
+//
+//  oceanWorkspace.h
+//  TessendorfOceanNode
+//
+//  Buffers and FFT plans reused by successive simulations of the same resolution.
+//
+
+#ifndef __TessendorfOceanNode__oceanWorkspace__
+#define __TessendorfOceanNode__oceanWorkspace__
+
+#include <complex>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "kissfftr2d.hh"
+#include "spectrumCache.h"
+
+/**
+ * A fixed-size array whose storage is aligned to a cache line (64 bytes). The contents are left uninitialized.
+ */
+template <typename T>
+class alignedArray {
+public:
+    alignedArray() : storage(NULL), data_(NULL), size_(0) {}
+    ~alignedArray() { delete [] storage; }
+    
+    /**
+     * Resizes the array, discarding its contents. Does nothing if the size is unchanged.
+     */
+    void resize(size_t count)
+    {
+        if (count == size_) {
+            return;
+        }
+        delete [] storage;
+        storage = count ? new char[count * sizeof(T) + 63] : NULL;
+        data_ = reinterpret_cast<T*>((reinterpret_cast<size_t>(storage) + 63) & ~(size_t)63);
+        size_ = count;
+    }
+    
+    T*          data() { return data_; }
+    const T*    data() const { return data_; }
+    size_t      size() const { return size_; }
+    size_t      bytes() const { return size_ * sizeof(T); }
+    
+private:
+    alignedArray(const alignedArray&);
+    alignedArray& operator=(const alignedArray&);
+    
+    char*       storage;
+    T*          data_;
+    size_t      size_;
+};
+
+/**
+ * Identifies the real fields left in a workspace by a simulation. Everything that changes the fields is here;
+ * choppiness only scales the displacement fields when they are assembled into points, so it is absent.
+ */
+struct oceanFieldsKey {
+    spectrumParams  spectrum;       /* Parameters of the initial spectrum. */
+    double          period;         /* Period T of the simulation (in s). */
+    double          phaseTime;      /* Time wrapped into the period, t mod T (in s). */
+    double          kMin;           /* Band of simulated wavevectors (see tessendorf::setBand). */
+    double          kMax;
+    bool            derivatives;    /* Whether the derivative grids were computed too. */
+    
+    /**
+     * Checks whether fields computed for `o` can stand in for the fields described by this key.
+     */
+    bool isSatisfiedBy(const oceanFieldsKey& o) const
+    {
+        return spectrum == o.spectrum && period == o.period && phaseTime == o.phaseTime && kMin == o.kMin
+            && kMax == o.kMax && (o.derivatives || !derivatives);
+    }
+};
+
+/**
+ * The state of incremental phase evaluation (see tessendorf::setIncremental): the phasors e^(i omega(k) t) of
+ * the last frame, and the rotation e^(i omega(k) dt) that advances them by one frame.
+ */
+struct oceanPhaseState {
+    bool            valid;          /* Whether the phasors hold the phases at `time`. */
+    double          time;           /* Phase time (t mod T) of the phasors. */
+    bool            stepValid;      /* Whether the step tables hold the rotation by `step`. */
+    double          step;           /* Time step of the rotation (in s). */
+    int             advances;       /* Number of frames the phasors were advanced since they were evaluated directly. */
+    bool            sparse;         /* Whether only the active waves' phasors and rotations are current. */
+};
+
+/**
+ * The working memory of a simulation: the FFT plan, the spectrum grids that are transformed in place, and one
+ * scratch buffer per worker thread. After a simulation the grids hold its real fields, which the next simulation
+ * reuses if they are still valid for it (see holds()).
+ *
+ * Keep one workspace per simulation context (e.g. per ocean node) and pass it to every tessendorf::simulate call.
+ * prepare() only reallocates when the resolution, scalar type or thread count changes, so playback at a fixed
+ * resolution does no heap allocation per frame. A workspace must not be used by two simulations at the same time.
+ *
+ * The grids, the FFT plan and the scratch memory come in the scalar type of the simulation (see
+ * tessendorf::setPrecision), float or double; the accessors for them take it as a template argument. A workspace
+ * holds the grids of one scalar type at a time.
+ */
+class oceanWorkspace {
+public:
+    typedef std::complex<float> complexf;
+    
+    enum grid {
+        HEIGHT = 0,     /* Height, equation (19). */
+        DISP_X,         /* X displacement, equation (29). */
+        DISP_Z,         /* Z displacement, equation (29). */
+        SLOPE_X,        /* dh/dx; the grids from here on are only allocated for derivatives. */
+        SLOPE_Z,        /* dh/dz. */
+        DISP_XX,        /* d(X displacement)/dx. */
+        DISP_ZZ,        /* d(Z displacement)/dz. */
+        DISP_XZ,        /* d(X displacement)/dz, which equals d(Z displacement)/dx. */
+        GRID_COUNT,
+        FIELD_GRID_COUNT = SLOPE_X
+    };
+    
+    /**
+     * Per-wavevector tables over the half plane of the spectrum, in the same layout as the grids. They depend
+     * only on the resolution, the plane size and the period, so they are built once and reused every frame.
+     */
+    enum table {
+        K_LENGTH = 0,   /* |k|. */
+        K_HAT_X,        /* X component of k / |k|; 0 where the wave can't displace sideways. */
+        K_HAT_Z,        /* Z component of k / |k|; likewise. */
+        OMEGA,          /* Dispersion omega(k), equation (17). */
+        TABLE_COUNT
+    };
+    
+    /**
+     * Tables for incremental phase evaluation, allocated only when it is used. Like the wavevector tables, they
+     * are only valid for the plane size and period those were built for.
+     */
+    enum phaseTable {
+        PHASE_RE = 0,   /* cos(omega(k) t) at the phase state's time. */
+        PHASE_IM,       /* sin(omega(k) t). */
+        STEP_RE,        /* cos(omega(k) dt) for the phase state's step. */
+        STEP_IM,        /* sin(omega(k) dt). */
+        PHASE_TABLE_COUNT
+    };
+    
+    oceanWorkspace();
+    
+    /**
+     * Sizes the workspace for an M x N grid of Scalar (float or double) simulated by up to `workers` threads.
+     * The derivative grids (SLOPE_X onwards) are allocated only if `derivatives` is set, and then kept for later
+     * simulations. Grids of the other scalar type are released, and so are the fields they held.
+     * \return true if anything had to be (re)allocated
+     */
+    template <typename Scalar = float>
+    bool                prepare(int M, int N, int workers, bool derivatives = false);
+    
+    /**
+     * Releases all memory held by the workspace.
+     */
+    void                release();
+    
+    /**
+     * Checks whether the real fields for `key` are already in the workspace, left by an earlier simulation
+     * (e.g. one that differed only in choppiness), so that the spectrum and the FFTs can be skipped.
+     */
+    bool                holds(const oceanFieldsKey& key) const { return hasContents && key.isSatisfiedBy(contents); }
+    
+    /**
+     * Records which fields the workspace now holds, after the spectrum grids were transformed.
+     */
+    void                setContents(const oceanFieldsKey& key) { contents = key; hasContents = true; }
+    
+    /**
+     * Forgets the fields held by the workspace, e.g. before the grids are overwritten.
+     */
+    void                invalidate() { hasContents = false; }
+    
+    int                 rows() const { return M; }
+    int                 cols() const { return N; }
+    
+    /** The FFT plan for grids of Scalar; call prepare<Scalar>() first. */
+    template <typename Scalar = float>
+    kissfftr2d<Scalar>& fft() { return *gridsFor<Scalar>().plan; }
+    
+    /** The spectrum (before the FFT) or real field (after it) for one output, of Scalar. */
+    template <typename Scalar = float>
+    std::complex<Scalar>* spectrum(grid g) { return gridsFor<Scalar>().grids[g].data(); }
+    
+    /** One of the wavevector tables, of fft().spectrumSize() elements. */
+    double*             waveTable(table t) { return tables[t].data(); }
+    
+    /**
+     * Checks whether the wavevector tables were built for a plane of Lx x Lz and the given period.
+     */
+    bool                holdsWaveTables(double Lx, double Lz, double period) const
+    {
+        return hasTables && tablesLx == Lx && tablesLz == Lz && tablesPeriod == period;
+    }
+    
+    /**
+     * Records the plane size and period the wavevector tables were just built for.
+     */
+    void                setWaveTables(double Lx, double Lz, double period)
+    {
+        tablesLx = Lx;
+        tablesLz = Lz;
+        tablesPeriod = period;
+        hasTables = true;
+        phases.valid = phases.stepValid = false; // The phasors were for the old dispersion.
+    }
+    
+    /**
+     * Allocates the phase tables if needed.
+     */
+    void                preparePhaseTables();
+    
+    /** One of the phase tables, of fft().spectrumSize() elements; call preparePhaseTables() first. */
+    double*             phaseTable(phaseTable t) { return phaseTables[t].data(); }
+    
+    /** The state of the phase tables. */
+    oceanPhaseState&    phaseState() { return phases; }
+    
+    /** Grid indices of the active waves within the band of the last simulation (see tessendorf::setEvaluation). */
+    std::vector<int>&   activeWaves() { return active; }
+    
+    /** Scratch memory for one worker, of fft<Scalar>().scratchSize() elements. */
+    template <typename Scalar = float>
+    std::complex<Scalar>* scratch(int worker) { return gridsFor<Scalar>().scratch.data() + worker * scratchSize; }
+    
+    /** Total bytes held by the workspace. */
+    size_t              bytes() const;
+    
+private:
+    oceanWorkspace(const oceanWorkspace&);
+    oceanWorkspace& operator=(const oceanWorkspace&);
+    
+    /**
+     * The memory of one scalar type: the FFT plan, the grids it transforms and the workers' scratch.
+     */
+    template <typename Scalar>
+    struct gridSet {
+        std::unique_ptr< kissfftr2d<Scalar> >       plan;
+        alignedArray< std::complex<Scalar> >        grids[GRID_COUNT];
+        alignedArray< std::complex<Scalar> >        scratch;
+        
+        void    release();
+        size_t  bytes() const;
+    };
+    
+    /** The grid set of Scalar (float or double). */
+    template <typename Scalar>
+    gridSet<Scalar>&    gridsFor();
+    
+    /** Number of elements of the wavevector and phase tables, (N/2 + 1) M. */
+    size_t              tableSize() const { return (size_t)M * (N / 2 + 1); }
+    
+    int                                 M;
+    int                                 N;
+    int                                 workers;
+    size_t                              scratchSize;
+    gridSet<float>                      singleGrids;
+    gridSet<double>                     doubleGrids;
+    alignedArray<double>                tables[TABLE_COUNT];
+    double                              tablesLx;       /* Plane size and period of the tables, if hasTables. */
+    double                              tablesLz;
+    double                              tablesPeriod;
+    bool                                hasTables;
+    alignedArray<double>                phaseTables[PHASE_TABLE_COUNT];
+    std::vector<int>                    active;
+    oceanPhaseState                     phases;
+    oceanFieldsKey                      contents;       /* The fields in the grids, if hasContents. */
+    bool                                hasContents;
+};
+
+template <>
+inline oceanWorkspace::gridSet<float>& oceanWorkspace::gridsFor<float>() { return singleGrids; }
+
+template <>
+inline oceanWorkspace::gridSet<double>& oceanWorkspace::gridsFor<double>() { return doubleGrids; }
+
+#endif /* defined(__TessendorfOceanNode__oceanWorkspace__) */
@@ -0,0 +1,130 @@
+//
+//  spectrumCache.cpp
+//  TessendorfOceanNode
+//
+
+#include "spectrumCache.h"
+
+#include <algorithm>
+
+size_t spectrumCache::capacity = (size_t)256 << 20;
+size_t spectrumCache::held = 0;
+
+std::mutex& spectrumCache::lock()
+{
+    static std::mutex m;
+    return m;
+}
+
+std::list<spectrumCache::entry>& spectrumCache::entries()
+{
+    static std::list<entry> e;
+    return e;
+}
+
+std::vector<spectrumParams>& spectrumCache::pending()
+{
+    static std::vector<spectrumParams> p;
+    return p;
+}
+
+std::condition_variable& spectrumCache::generated()
+{
+    static std::condition_variable c;
+    return c;
+}
+
+spectrumCache::entry spectrumCache::acquire(const spectrumParams& params, const std::function<entry()>& generate, bool* hit)
+{
+    std::unique_lock<std::mutex> guard(lock());
+    std::vector<spectrumParams>& p = pending();
+    
+    // Wait while another caller generates the same spectrum.
+    for (;;) {
+        entry cached = find(params);
+        if (cached) {
+            *hit = true;
+            return cached;
+        }
+        if (std::find(p.begin(), p.end(), params) == p.end()) {
+            break;
+        }
+        generated().wait(guard);
+    }
+    
+    p.push_back(params);
+    guard.unlock();
+    
+    entry spectrum;
+    try {
+        spectrum = generate();
+    } catch (...) {
+        guard.lock();
+        p.erase(std::find(p.begin(), p.end(), params));
+        generated().notify_all(); // A waiter takes over the generation.
+        throw;
+    }
+    
+    guard.lock();
+    p.erase(std::find(p.begin(), p.end(), params));
+    insert(spectrum);
+    generated().notify_all();
+    *hit = false;
+    return spectrum;
+}
+
+/**
+ * Finds a cached spectrum and makes it the most recently used. Called with the lock held.
+ */
+spectrumCache::entry spectrumCache::find(const spectrumParams& params)
+{
+    std::list<entry>& e = entries();
+    
+    for (std::list<entry>::iterator it = e.begin(); it != e.end(); ++it) {
+        if ((*it)->params == params) {
+            e.splice(e.begin(), e, it); // Move to the front (most recently used).
+            return e.front();
+        }
+    }
+    
+    return entry();
+}
+
+/**
+ * Adds a spectrum as the most recently used and evicts spectra beyond the capacity. Called with the lock held.
+ */
+void spectrumCache::insert(const entry& spectrum)
+{
+    std::list<entry>& e = entries();
+    
+    e.push_front(spectrum);
+    held += spectrum->bytes();
+    evict(1);
+}
+
+void spectrumCache::setCapacity(size_t bytes)
+{
+    std::lock_guard<std::mutex> guard(lock());
+    capacity = bytes;
+    evict(0);
+}
+
+void spectrumCache::clear()
+{
+    std::lock_guard<std::mutex> guard(lock());
+    entries().clear();
+    held = 0;
+}
+
+/**
+ * Drops the least recently used spectra until the cache fits its capacity, keeping at least the first `keep`.
+ * Called with the lock held.
+ */
+void spectrumCache::evict(size_t keep)
+{
+    std::list<entry>& e = entries();
+    while (held > capacity && e.size() > keep) {
+        held -= e.back()->bytes();
+        e.pop_back();
+    }
+}
@@ -0,0 +1,99 @@
+//
+//  spectrumCache.h
+//  TessendorfOceanNode
+//
+//  Process-wide cache of initial wave spectra (h~-sub-naught grids), so that simulations
+//  that differ only in time or choppiness do not regenerate them.
+//
+
+#ifndef __TessendorfOceanNode__spectrumCache__
+#define __TessendorfOceanNode__spectrumCache__
+
+#include <complex>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * The parameters that determine an initial spectrum. Time and choppiness are deliberately absent.
+ */
+struct spectrumParams {
+    double  A;          /* Controls height of Phillips spectrum. */
+    double  V;          /* Wind speed (in m/s). */
+    double  w_x;        /* X component of the (unit) wind direction. */
+    double  w_z;        /* Z component of the (unit) wind direction. */
+    double  Lx;         /* Length of plane along X-axis (in m). */
+    double  Lz;         /* Length of plane along Z-axis (in m). */
+    double  l;          /* Size limit that waves must surpass to be rendered. */
+    int     M;          /* Resolution of grid along Z-axis (number of rows). */
+    int     N;          /* Resolution of grid along X-axis (number of columns). */
+    int     seed;       /* Seed for the pseudorandom number generator. */
+    
+    bool operator==(const spectrumParams& o) const
+    {
+        return A == o.A && V == o.V && w_x == o.w_x && w_z == o.w_z && Lx == o.Lx && Lz == o.Lz
+            && l == o.l && M == o.M && N == o.N && seed == o.seed;
+    }
+};
+
+/**
+ * The time-independent part of Tessendorf's equation (26) over the M x (N/2 + 1) half plane of wavevectors with
+ * non-negative x-frequency, stored row-major in FFT order.
+ */
+struct initialSpectrum {
+    spectrumParams                      params;
+    std::vector< std::complex<double> > h0;             /* h~0(k) for each grid index. */
+    std::vector< std::complex<double> > h0_minus_conj;  /* conj(h~0(-k)) for each grid index. */
+    std::vector<int>                    active;         /* Grid indices of the waves that hold all but a negligible
+                                                           fraction of the energy, in increasing order. */
+    
+    /** The memory held by the spectrum, in bytes. */
+    size_t bytes() const
+    {
+        return (h0.capacity() + h0_minus_conj.capacity()) * sizeof(std::complex<double>) + active.capacity() * sizeof(int);
+    }
+};
+
+/**
+ * A thread-safe, least-recently-used cache of initial spectra, bounded by the memory they hold.
+ */
+class spectrumCache {
+public:
+    typedef std::shared_ptr<const initialSpectrum> entry;
+    
+    /**
+     * Gets the cached spectrum for the given parameters, or calls `generate` to make it and adds it to the cache.
+     * Concurrent misses on the same parameters generate the spectrum once: the other callers wait for it.
+     * Adding a spectrum evicts the least recently used ones while the cache holds more than its capacity; the
+     * spectrum just added is always kept, even if it alone exceeds the capacity.
+     * \param hit set to whether the spectrum was found in the cache or generated by another caller
+     */
+    static entry        acquire(const spectrumParams& params, const std::function<entry()>& generate, bool* hit);
+    
+    /**
+     * Sets the memory, in bytes, that the cache may keep alive (default 256 MB: one spectrum of a 2048 x 2048
+     * grid takes 67 MB, one of a 256 x 256 grid 1 MB).
+     */
+    static void         setCapacity(size_t bytes);
+    
+    /**
+     * Drops every cached spectrum. Spectra still referenced by simulations stay alive until released.
+     */
+    static void         clear();
+    
+private:
+    static std::mutex&          lock();
+    static std::list<entry>&    entries();
+    static std::vector<spectrumParams>& pending();  /* Parameters of the spectra being generated. */
+    static std::condition_variable&     generated();
+    static entry                find(const spectrumParams& params);
+    static void                 insert(const entry& spectrum);
+    static void                 evict(size_t keep);
+    static size_t               capacity;   /* Maximum bytes held, see setCapacity. */
+    static size_t               held;       /* Bytes held by the cached spectra. */
+};
+
+#endif /* defined(__TessendorfOceanNode__spectrumCache__) */
@@ -8,11 +8,14 @@
 
 #include "tessendorf.h"
 #include "helpers.h"
-#include "kissfft.hh"
-#include <maya/MGlobal.h>
-#include <sstream>
+#include "kissfftr2d.hh"
+#include "threadPool.h"
+#include "oceanProfile.h"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
 
-tessendorf::tessendorf(double amplitude, double speed, MVector direction, double choppiness, double time, int resX, int resZ, double scaleX, double scaleZ, double waveSizeLimit, int rngSeed)
+tessendorf::tessendorf(double amplitude, double speed, vector3 direction, double choppiness, double time, int resX, int resZ, double scaleX, double scaleZ, double waveSizeLimit, int rngSeed)
 {
     // Parameters.
     A = amplitude;
@@ -20,12 +23,22 @@ tessendorf::tessendorf(double amplitude, double speed, MVector direction, double
     w_hat = direction.normal();
     t = time;
     lambda = choppiness;
-    M = resX;
-    N = resZ;
+    M = resZ;
+    N = resX;
     Lx = scaleX;
     Lz = scaleZ;
     l = waveSizeLimit;
     seed = rngSeed;
+    threads = 0;
+    incremental = false;
+    requestedEvaluation = EVAL_AUTO;
+    fieldPrecision = PRECISION_SINGLE;
+    lastPath = EVAL_FULL_FFT;
+    lastActiveWaves = 0;
+    stages = stageTimes();
+    profile = NULL;
+    k_min = 0.;
+    k_max = DBL_MAX;
     
     // Precalculate known constants.
     P_h__L = pow(V, 2) / GRAVITY;
@@ -34,15 +47,49 @@ tessendorf::tessendorf(double amplitude, double speed, MVector direction, double
 
 tessendorf::~tessendorf()
 {
-    vertices.setLength(0);
 }
 
-double tessendorf::omega(MVector k)
+void tessendorf::setThreadCount(int threadCount)
+{
+    threads = threadCount;
+}
+
+void tessendorf::setPeriod(double period)
+{
+    T = period;
+    omega_0 = 2. * M_PI / T;
+}
+
+void tessendorf::setBand(double kMin, double kMax)
+{
+    k_min = kMin;
+    k_max = kMax;
+}
+
+tessendorf tessendorf::cascade(int index, int count, double ratio) const
+{
+    // The largest wavevector that cascade i resolves in every direction: the radius of its Nyquist circle.
+    auto nyquist = [&](int i) { return M_PI * std::min(N / Lx, M / Lz) * pow(ratio, i); };
+    
+    tessendorf c(*this);
+    c.Lx = Lx / pow(ratio, index);
+    c.Lz = Lz / pow(ratio, index);
+    // The Phillips spectrum gives the energy of each wave for the spacing of the wavevectors, (2 pi)^2 / (Lx Lz),
+    // which is ratio^2i times coarser in cascade i, so each of its waves carries that much more energy.
+    c.A = A * (Lx * Lz) / (c.Lx * c.Lz);
+    c.seed = seed + 7919 * index;
+    c.spectrum.reset();
+    c.setBand(index == 0 ? k_min : std::max(k_min, nyquist(index - 1)),
+              index == count - 1 ? k_max : std::min(k_max, nyquist(index)));
+    return c;
+}
+
+double tessendorf::omega(vector3 k)
 {
     return floor(sqrt(GRAVITY * k.length()) / omega_0) * omega_0;
 }
 
-double tessendorf::P_h(MVector k)
+double tessendorf::P_h(vector3 k)
 {
     double k_length = k.length();
     
@@ -50,7 +97,7 @@ double tessendorf::P_h(MVector k)
         return 0.; // Avoid divison by zero error.
     }
     
-    MVector k_hat = k.normal();
+    vector3 k_hat = k.normal();
     
     double nomin = exp(-1. / pow(k_length * P_h__L, 2));
     double denom = pow(k_length, 4);
@@ -59,88 +106,705 @@ double tessendorf::P_h(MVector k)
     return A * nomin / denom * pow(k_hat * w_hat, 2) * scale;
 }
 
-complex tessendorf::h_tilde_0(MVector k)
+complex tessendorf::h_tilde_0(vector3 k, int kx, int kz)
 {
-    complex xi = random_gaussian_complex();
+    complex xi = random_gaussian_complex(seed, kx, kz);
     
     return xi * (double)sqrt(P_h(k) / 2.);
 }
 
-complex tessendorf::h_tilde(MVector k)
+void tessendorf::end_stage(std::chrono::steady_clock::time_point& since, double& stage, const char* name)
 {
-    complex h_tilde_0_k = h_tilde_0(k);
-    complex h_tilde_0_k_star = h_tilde_0(-k);
-    
-    double omega_k_t = omega(k) * t;
-    
-    double cos_omega_k_t = cos(omega_k_t);
-    double sin_omega_k_t = sin(omega_k_t);
-    
-    complex c0(cos_omega_k_t, sin_omega_k_t);
-    complex c1(cos_omega_k_t, -sin_omega_k_t);
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    stage = std::chrono::duration<double, std::milli>(now - since).count();
+    if (profile) {
+        profile->record(name, since, now);
+    }
+    since = now;
+}
+
+#define SPARSE_ENERGY_FRACTION   1e-12  // Fraction of the spectrum's energy that sparse evaluation may leave out.
+#define PHASE_RENORMALIZE_FRAMES 16     // Incremental phasors are renormalized after this many advances...
+#define PHASE_RESYNC_FRAMES      1024   // ...and evaluated directly again after this many.
+
+/**
+ * How the fused spectrum kernel gets e^(i omega(k) t) for each k.
+ */
+enum phase_mode {
+    PHASE_DIRECT = 0,   /* Evaluate sin and cos. */
+    PHASE_STORE,        /* Evaluate sin and cos, and keep the phasors for the next frame. */
+    PHASE_START_STEP,   /* Evaluate the rotation for a new time step, then advance the kept phasors by it. */
+    PHASE_ADVANCE       /* Advance the kept phasors by the stored rotation. */
+};
+
+/**
+ * Wraps an integer frequency onto the range [-n/2, n/2) covered by a grid of n samples.
+ */
+static int wrap_frequency(int k, int n)
+{
+    k = ((k + n / 2) % n + n) % n;
+    return k - n / 2;
+}
+
+vector3 tessendorf::wave_vector(int kx, int kz)
+{
+    return vector3(2. * M_PI * kx / Lx, 0., 2. * M_PI * kz / Lz);
+}
+
+spectrumParams tessendorf::spectrum_params() const
+{
+    spectrumParams params = { A, V, w_hat.x, w_hat.z, Lx, Lz, l, M, N, seed };
+    return params;
+}
+
+spectrumCache::entry tessendorf::initial_spectrum()
+{
+    spectrumParams params = spectrum_params();
     
-    return h_tilde_0_k * c0 + h_tilde_0_k_star * c1;
+    bool hit;
+    spectrumCache::entry spectrum = spectrumCache::acquire(params, [&]() { return generate_spectrum(params); }, &hit);
+    if (profile) {
+        if (hit) {
+            profile->spectrumHits++;
+        } else {
+            profile->spectrumMisses++;
+            profile->bytesAllocated += spectrum->bytes();
+        }
+    }
+    return spectrum;
 }
 
-MFloatPointArray tessendorf::simulate()
+spectrumCache::entry tessendorf::generate_spectrum(const spectrumParams& params)
 {
-    srand(seed);
-    vertices.clear();
+    int halfN = N / 2 + 1;
     
-    complex* h_tildes_in = new complex[M*N];
-    complex* disp_x_in = new complex[M*N];
-    complex* disp_z_in = new complex[M*N];
+    std::shared_ptr<initialSpectrum> result = std::make_shared<initialSpectrum>();
+    result->params = params;
+    result->h0.resize(M * halfN);
+    result->h0_minus_conj.resize(M * halfN);
     
-    complex* h_tildes_out = new complex[M*N];
-    complex* disp_x_out = new complex[M*N];
-    complex* disp_z_out = new complex[M*N];
+    threadPool& pool = threadPool::shared();
+    int workers = threadPool::resolveThreads(threads);
+    initialSpectrum& s = *result;
     
-    for (int m = 0; m < M; m++) {
-        for (int n = 0; n < N; n++) {
-            int index = m * N + n;
+    // Only the non-negative x-frequencies are stored (see tessendorf::simulate). Both h~0(k) and h~0(-k) are
+    // drawn directly, which gives the same values a full grid would hold at k and at its mirror -k.
+    pool.parallelFor(M, workers, [&](int m, int) {
+        int kz = wrap_frequency(m, M);
+        for (int n = 0; n < halfN; n++) {
+            int kx = wrap_frequency(n, N);
+            int index = m * halfN + n;
             
-            int m_ = m - M / 2;  // m coord offsetted.
-            int n_ = n - N / 2; // n coord offsetted.
+            int kx_minus = wrap_frequency(-kx, N);
+            int kz_minus = wrap_frequency(-kz, M);
             
-            MVector k(2. * M_PI * n_ / Lx, 0., 2. * M_PI * m_ / Lz);
+            s.h0[index] = h_tilde_0(wave_vector(kx, kz), kx, kz);
+            s.h0_minus_conj[index] = conj(h_tilde_0(wave_vector(kx_minus, kz_minus), kx_minus, kz_minus));
+        }
+    });
+    
+    // Find the active waves for sparse evaluation: leave out the weakest waves as long as together they hold no
+    // more than SPARSE_ENERGY_FRACTION of the energy. Grouping the energies by binary exponent finds the cutoff
+    // in linear time, and is precise enough for a fraction this small.
+    const int buckets = 2 * 1100;
+    std::vector<double> energy_by_exponent(buckets, 0.);
+    double total = 0.;
+    for (int i = 0; i < M * halfN; i++) {
+        double energy = std::norm(s.h0[i]) + std::norm(s.h0_minus_conj[i]);
+        if (energy > 0.) {
+            int exponent;
+            frexp(energy, &exponent);
+            energy_by_exponent[exponent + buckets / 2] += energy;
+            total += energy;
+        }
+    }
+    
+    int cutoff = 0;
+    double dropped = 0.;
+    while (cutoff < buckets && dropped + energy_by_exponent[cutoff] <= SPARSE_ENERGY_FRACTION * total) {
+        dropped += energy_by_exponent[cutoff++];
+    }
+    for (int i = 0; i < M * halfN; i++) {
+        double energy = std::norm(s.h0[i]) + std::norm(s.h0_minus_conj[i]);
+        int exponent;
+        frexp(energy, &exponent);
+        if (energy > 0. && exponent + buckets / 2 >= cutoff) {
+            s.active.push_back(i);
+        }
+    }
+    
+    return result;
+}
+
+void tessendorf::wave_tables(oceanWorkspace& workspace, int workers)
+{
+    if (workspace.holdsWaveTables(Lx, Lz, T)) {
+        return;
+    }
+    
+    int halfN = N / 2 + 1;
+    double* k_lengths = workspace.waveTable(oceanWorkspace::K_LENGTH);
+    double* k_hat_xs = workspace.waveTable(oceanWorkspace::K_HAT_X);
+    double* k_hat_zs = workspace.waveTable(oceanWorkspace::K_HAT_Z);
+    double* omegas = workspace.waveTable(oceanWorkspace::OMEGA);
+    
+    threadPool::shared().parallelFor(M, workers, [&](int m, int) {
+        int kz = wrap_frequency(m, M);
+        for (int n = 0; n < halfN; n++) {
+            int kx = wrap_frequency(n, N);
+            int index = m * halfN + n;
             
-            complex h_tilde_k = h_tilde(k);
-            h_tildes_in[index] = h_tilde_k;
+            vector3 k = wave_vector(kx, kz);
+            vector3 k_hat = kx == -N / 2 || kz == -M / 2 ? vector3() : k.normal();
+            k_lengths[index] = k.length();
+            k_hat_xs[index] = k_hat.x;
+            k_hat_zs[index] = k_hat.z;
+            omegas[index] = omega(k);
+        }
+    });
+    
+    workspace.setWaveTables(Lx, Lz, T);
+}
+
+const char* tessendorf::evaluationName(evaluation path)
+{
+    switch (path) {
+        case EVAL_FULL_FFT:     return "full FFT";
+        case EVAL_PRUNED_FFT:   return "pruned FFT";
+        case EVAL_DIRECT_SUM:   return "direct sum";
+        case EVAL_REUSED:       return "reused fields";
+        default:                return "auto";
+    }
+}
+
+const char* tessendorf::precisionName(precision scalar)
+{
+    return scalar == PRECISION_DOUBLE ? "double" : "single";
+}
+
+tessendorf::evaluation tessendorf::choose_evaluation(oceanWorkspace& workspace, int gridCount)
+{
+    int halfN = N / 2 + 1;
+    const double* k_lengths = workspace.waveTable(oceanWorkspace::K_LENGTH);
+    std::vector<int>& active = workspace.activeWaves();
+    active.clear();
+    
+    std::vector<char> used(halfN, 0);
+    for (size_t i = 0; i < spectrum->active.size(); i++) {
+        int index = spectrum->active[i];
+        if (k_lengths[index] >= k_min && k_lengths[index] < k_max) {
+            active.push_back(index);
+            used[index % halfN] = 1;
+        }
+    }
+    
+    if (requestedEvaluation != EVAL_AUTO) {
+        return (evaluation)requestedEvaluation;
+    }
+    
+    // Rough costs in flops: filling a wave takes about 40, a complex FFT of length n about 5 n log2(n), and the
+    // real transform of a row a half-length FFT plus its post-processing. The pruned FFT also clears the grids
+    // and transforms only the columns in use; the direct sum evaluates every active wave at every grid point,
+    // which measures at about 6 flops' worth per grid.
+    int activeColumns = 0;
+    for (int n = 0; n < halfN; n++) {
+        activeColumns += used[n];
+    }
+    double cells = (double)M * halfN;
+    double waves = (double)active.size();
+    double columnPass = 5. * halfN * M * log2((double)M);
+    double rowPass = 5. * M * (N / 2) * log2((double)std::max(N / 2, 2)) + 8. * cells;
+    
+    double full = 40. * cells + gridCount * (columnPass + rowPass);
+    double pruned = 40. * waves + gridCount * (cells + columnPass * activeColumns / halfN + rowPass);
+    double direct = 40. * waves + waves * (2. * (M + N) + (double)M * N * (4. + 6. * gridCount));
+    
+    if (direct < pruned && direct < full) {
+        return EVAL_DIRECT_SUM;
+    }
+    return pruned < full ? EVAL_PRUNED_FFT : EVAL_FULL_FFT;
+}
+
+template <typename Scalar>
+void tessendorf::direct_sum(oceanWorkspace& workspace, int workers, int gridCount, const std::vector<int>& active)
+{
+    typedef std::complex<Scalar> cpx;
+    kissfftr2d<Scalar>& fft = workspace.fft<Scalar>();
+    int halfN = fft.halfCols();
+    int realStride = fft.realStride();
+    size_t waves = active.size();
+    
+    // Take each wave's coefficients before the results overwrite the spectra. The half plane stands for the
+    // whole spectrum: a wave outside columns 0 and N/2 also stands for its conjugate at -k, and together they
+    // contribute twice the real part of the one.
+    Scalar* grids[oceanWorkspace::GRID_COUNT];
+    std::vector<cpx> coefficients(waves * gridCount);
+    for (int g = 0; g < gridCount; g++) {
+        grids[g] = reinterpret_cast<Scalar*>(workspace.spectrum<Scalar>((oceanWorkspace::grid)g));
+        const cpx* spectrum_g = workspace.spectrum<Scalar>((oceanWorkspace::grid)g);
+        for (size_t w = 0; w < waves; w++) {
+            int n = active[w] % halfN;
+            Scalar weight = n == 0 || 2 * n == N ? 1 : 2;
+            coefficients[w * gridCount + g] = weight * spectrum_g[active[w]];
+        }
+    }
+    
+    // e^(2 pi i j / M) and e^(2 pi i j / N), so that the phase of wave (m, n) at grid point (r, c) is a lookup.
+    std::vector<complex> row_roots(M), column_roots(N);
+    for (int j = 0; j < M; j++) {
+        row_roots[j] = std::polar(1., 2. * M_PI * j / M);
+    }
+    for (int j = 0; j < N; j++) {
+        column_roots[j] = std::polar(1., 2. * M_PI * j / N);
+    }
+    
+    // Each worker sums whole rows: per wave, it looks up the phases along the row once, and then accumulates
+    // every grid in a loop that vectorizes.
+    std::vector< std::vector<double> > sums(workers, std::vector<double>((size_t)(gridCount + 2) * N));
+    threadPool::shared().parallelFor(M, workers, [&](int r, int worker) {
+        std::vector<double>& sum = sums[worker];
+        std::fill(sum.begin(), sum.begin() + (size_t)gridCount * N, 0.);
+        double* phase_re = &sum[(size_t)gridCount * N];
+        double* phase_im = phase_re + N;
+        
+        for (size_t w = 0; w < waves; w++) {
+            int m = active[w] / halfN;
+            int n = active[w] % halfN;
+            for (int c = 0, j = 0; c < N; c++) {
+                phase_re[c] = column_roots[j].real();
+                phase_im[c] = column_roots[j].imag();
+                j += n;
+                j -= j >= N ? N : 0;
+            }
             
-            MVector k_hat = k.normal();
-            disp_x_in[index] = complex(0., -k_hat.x) * h_tilde_k; // Displacement by equation (29).
-            disp_z_in[index] = complex(0., -k_hat.z) * h_tilde_k;
+            complex row_phase = row_roots[(size_t)m * r % M];
+            for (int g = 0; g < gridCount; g++) {
+                complex a = complex(coefficients[w * gridCount + g]) * row_phase;
+                double a_re = a.real(), a_im = a.imag();
+                double* sum_g = &sum[(size_t)g * N];
+                for (int c = 0; c < N; c++) {
+                    sum_g[c] += a_re * phase_re[c] - a_im * phase_im[c];
+                }
+            }
+        }
+        
+        for (int g = 0; g < gridCount; g++) {
+            Scalar* row = grids[g] + (size_t)r * realStride;
+            for (int c = 0; c < N; c++) {
+                row[c] = (Scalar)sum[(size_t)g * N + c];
+            }
+        }
+    });
+}
+
+floatPointArray tessendorf::simulate()
+{
+    oceanWorkspace workspace;
+    floatPointArray points(M*N);
+    simulate(workspace, &points[0].x, sizeof(floatPoint) / sizeof(float));
+    return points;
+}
+
+template <typename Scalar>
+void tessendorf::transform_fields(oceanWorkspace& workspace, int workers, bool derivatives)
+{
+    typedef std::complex<Scalar> cpx;
+    threadPool& pool = threadPool::shared();
+    std::chrono::steady_clock::time_point stage_start = std::chrono::steady_clock::now();
+    stages = stageTimes();
+    
+    workspace.prepare<Scalar>(M, N, workers, derivatives);
+    
+    oceanFieldsKey key = { spectrum_params(), T, fmod(t, T), k_min, k_max, derivatives };
+    if (workspace.holds(key)) {
+        lastPath = EVAL_REUSED;
+        if (profile) {
+            profile->fieldHits++;
+        }
+        return;
+    }
+    if (profile) {
+        profile->fieldMisses++;
+    }
+    workspace.invalidate(); // The grids are about to be overwritten.
+    
+    spectrum = initial_spectrum();
+    end_stage(stage_start, stages.spectrum, "spectrum");
+    
+    // The height and displacement fields are real, so their spectra are Hermitian (h~(-k) = conj(h~(k)), which
+    // follows from equation (26)) and only the half plane of non-negative x-frequencies is needed: M rows of
+    // N/2 + 1 columns, in FFT order (row m holds z-frequency m for m < M/2 and m - M otherwise).
+    // The spectrum is evaluated in double precision, and the grids and FFTs in Scalar (see setPrecision): with
+    // floats, the output's precision, the FFTs use the SIMD kernels.
+    kissfftr2d<Scalar>& fft = workspace.fft<Scalar>();
+    int halfN = fft.halfCols();
+    
+    cpx* h_tildes = workspace.spectrum<Scalar>(oceanWorkspace::HEIGHT);
+    cpx* disp_x = workspace.spectrum<Scalar>(oceanWorkspace::DISP_X);
+    cpx* disp_z = workspace.spectrum<Scalar>(oceanWorkspace::DISP_Z);
+    cpx* slope_x = workspace.spectrum<Scalar>(oceanWorkspace::SLOPE_X);
+    cpx* slope_z = workspace.spectrum<Scalar>(oceanWorkspace::SLOPE_Z);
+    cpx* disp_xx = workspace.spectrum<Scalar>(oceanWorkspace::DISP_XX);
+    cpx* disp_zz = workspace.spectrum<Scalar>(oceanWorkspace::DISP_ZZ);
+    cpx* disp_xz = workspace.spectrum<Scalar>(oceanWorkspace::DISP_XZ);
+    
+    wave_tables(workspace, workers);
+    end_stage(stage_start, stages.waveTables, "waveTables");
+    const double* k_lengths = workspace.waveTable(oceanWorkspace::K_LENGTH);
+    const double* k_hat_xs = workspace.waveTable(oceanWorkspace::K_HAT_X);
+    const double* k_hat_zs = workspace.waveTable(oceanWorkspace::K_HAT_Z);
+    const double* omegas = workspace.waveTable(oceanWorkspace::OMEGA);
+    const complex* h0 = &spectrum->h0[0];
+    const complex* h0_minus_conj = &spectrum->h0_minus_conj[0];
+    
+    // omega(k) is a multiple of omega_0, so the phase repeats every T; wrapping t keeps it accurate for long shots.
+    double phase_time = fmod(t, T);
+    
+    // Choose how to evaluate the fields. The sparse paths only evaluate the active waves.
+    cpx* grids[] = { h_tildes, disp_x, disp_z, slope_x, slope_z, disp_xx, disp_zz, disp_xz };
+    const int gridCount = derivatives ? oceanWorkspace::GRID_COUNT : oceanWorkspace::FIELD_GRID_COUNT;
+    std::vector<int> previous_active;
+    if (incremental) {
+        previous_active = workspace.activeWaves();
+    }
+    evaluation path = choose_evaluation(workspace, gridCount);
+    const std::vector<int>& active = workspace.activeWaves();
+    bool sparse = path != EVAL_FULL_FFT;
+    lastPath = path;
+    lastActiveWaves = active.size();
+    
+    // Choose how to evaluate the phases (see setIncremental).
+    phase_mode mode = PHASE_DIRECT;
+    bool renormalize = false;
+    double* phase_re = NULL;
+    double* phase_im = NULL;
+    double* step_re = NULL;
+    double* step_im = NULL;
+    double step = 0.;
+    if (incremental) {
+        // Sparse paths only keep the phasors of the active waves, so they can't continue from a frame that
+        // evaluated other waves.
+        oceanPhaseState& state = workspace.phaseState();
+        if ((sparse || state.sparse) && (sparse != state.sparse || active != previous_active)) {
+            state.valid = state.stepValid = false;
+        }
+        
+        workspace.preparePhaseTables();
+        phase_re = workspace.phaseTable(oceanWorkspace::PHASE_RE);
+        phase_im = workspace.phaseTable(oceanWorkspace::PHASE_IM);
+        step_re = workspace.phaseTable(oceanWorkspace::STEP_RE);
+        step_im = workspace.phaseTable(oceanWorkspace::STEP_IM);
+        
+        // The phasors repeat every T too, so a step across the end of the period is still one step.
+        step = state.valid ? fmod(phase_time - state.time + T, T) : 0.;
+        bool oneStep = state.valid && step > 0. && fabs(step - state.step) <= 1e-6 * state.step;
+        
+        if (!oneStep || state.advances >= PHASE_RESYNC_FRAMES) {
+            mode = PHASE_STORE;
+            step = oneStep ? state.step : step;
+        } else {
+            mode = state.stepValid ? PHASE_ADVANCE : PHASE_START_STEP;
+            step = state.step;
+            renormalize = (state.advances + 1) % PHASE_RENORMALIZE_FRAMES == 0;
+        }
+    }
+    
+    // Fills the spectra at grid index i. Complex products are written out in real arithmetic, which spares the
+    // checks for infinities in std::complex multiplication.
+    auto fill = [&](size_t i) {
+        double k_length = k_lengths[i];
+        double k_hat_x = k_hat_xs[i];
+        double k_hat_z = k_hat_zs[i];
+        
+        // h~(k, t) by equation (26), or 0 outside the band.
+        double in_band = k_length >= k_min && k_length < k_max ? 1. : 0.;
+        double c, s;
+        if (mode <= PHASE_STORE) {
+            double omega_k_t = omegas[i] * phase_time;
+            c = cos(omega_k_t);
+            s = sin(omega_k_t);
+        } else {
+            if (mode == PHASE_START_STEP) {
+                step_re[i] = cos(omegas[i] * step);
+                step_im[i] = sin(omegas[i] * step);
+            }
+            c = phase_re[i] * step_re[i] - phase_im[i] * step_im[i];
+            s = phase_re[i] * step_im[i] + phase_im[i] * step_re[i];
+            if (renormalize) {
+                // One Newton step towards |e^(i omega t)| = 1, which stops rounding errors from compounding.
+                double scale = 1.5 - .5 * (c * c + s * s);
+                c *= scale;
+                s *= scale;
+            }
+        }
+        if (mode != PHASE_DIRECT) {
+            phase_re[i] = c;
+            phase_im[i] = s;
+        }
+        c *= in_band;
+        s *= in_band;
+        double a = h0[i].real(), b = h0[i].imag();
+        double p = h0_minus_conj[i].real(), q = h0_minus_conj[i].imag();
+        double h_re = (a * c - b * s) + (p * c + q * s);
+        double h_im = (a * s + b * c) + (q * c - p * s);
+        
+        h_tildes[i] = cpx((Scalar)h_re, (Scalar)h_im);
+        
+        // Displacement by equation (29): -i k^ h~. The direction of a Nyquist wave is ambiguous (k and -k
+        // alias), so its k^ is 0 in the tables and it neither displaces sideways nor has a slope.
+        disp_x[i] = cpx((Scalar)(k_hat_x * h_im), (Scalar)(-k_hat_x * h_re));
+        disp_z[i] = cpx((Scalar)(k_hat_z * h_im), (Scalar)(-k_hat_z * h_re));
+        
+        if (derivatives) {
+            // Differentiating the series multiplies each term by i k; for the displacement, the i from the
+            // derivative cancels the -i of equation (29).
+            double k_x = k_hat_x * k_length;
+            double k_z = k_hat_z * k_length;
+            slope_x[i] = cpx((Scalar)(-k_x * h_im), (Scalar)(k_x * h_re));
+            slope_z[i] = cpx((Scalar)(-k_z * h_im), (Scalar)(k_z * h_re));
+            disp_xx[i] = cpx((Scalar)(k_x * k_hat_x * h_re), (Scalar)(k_x * k_hat_x * h_im));
+            disp_zz[i] = cpx((Scalar)(k_z * k_hat_z * h_re), (Scalar)(k_z * k_hat_z * h_im));
+            disp_xz[i] = cpx((Scalar)(k_x * k_hat_z * h_re), (Scalar)(k_x * k_hat_z * h_im));
+        }
+    };
+    
+    if (!sparse) {
+        // One pass over the tables, one row per work item.
+        pool.parallelFor(M, workers, [&](int m, int) {
+            size_t begin = (size_t)m * halfN;
+            for (size_t i = begin; i < begin + halfN; i++) {
+                fill(i);
+            }
+        });
+    } else {
+        if (path == EVAL_PRUNED_FFT) {
+            // Every other wave is left out, so it must be zero for the FFT.
+            size_t cells = (size_t)M * halfN;
+            pool.parallelFor(gridCount, workers, [&](int g, int) { std::fill(grids[g], grids[g] + cells, cpx()); });
+        }
+        int chunks = (int)((active.size() + 1023) / 1024);
+        pool.parallelFor(chunks, workers, [&](int chunk, int) {
+            size_t begin = (size_t)chunk * 1024;
+            size_t end = std::min(begin + 1024, active.size());
+            for (size_t i = begin; i < end; i++) {
+                fill(active[i]);
+            }
+        });
+    }
+    
+    if (mode != PHASE_DIRECT) {
+        oceanPhaseState& state = workspace.phaseState();
+        state.valid = true;
+        state.sparse = sparse;
+        state.time = phase_time;
+        if (mode == PHASE_STORE) {
+            // Expect the next frame to follow with the same step as this one; its rotation is evaluated when
+            // that frame arrives.
+            if (step > 0. && step != state.step) {
+                state.step = step;
+                state.stepValid = false;
+            }
+            state.advances = 0;
+        } else {
+            state.stepValid = true;
+            state.advances++;
+        }
+    }
+    
+    end_stage(stage_start, stages.fill, "fill");
+    
+    if (path == EVAL_DIRECT_SUM) {
+        direct_sum<Scalar>(workspace, workers, gridCount, active);
+        end_stage(stage_start, stages.fftRows, "directSum");
+        workspace.setContents(key);
+        return;
+    }
+    
+    // Equations (19) and (29) are inverse 2D transforms with real results. Transform the columns and then the
+    // rows in place; the batches of all the grids form a single parallel loop per pass.
+    if (path == EVAL_PRUNED_FFT) {
+        // Only the columns that hold active waves; the others are zero and stay zero. Runs of such columns
+        // are split into pieces no wider than a column batch.
+        std::vector<char> used(halfN, 0);
+        for (size_t i = 0; i < active.size(); i++) {
+            used[active[i] % halfN] = 1;
+        }
+        std::vector< std::pair<int, int> > runs;
+        for (int n = 0; n < halfN; n++) {
+            if (!used[n]) {
+                continue;
+            }
+            if (runs.empty() || runs.back().second != n || n - runs.back().first >= fft.columnsPerBatch()) {
+                runs.push_back(std::make_pair(n, n + 1));
+            } else {
+                runs.back().second++;
+            }
         }
+        
+        int runCount = (int)runs.size();
+        pool.parallelFor(gridCount * runCount, workers, [&](int i, int worker) {
+            const std::pair<int, int>& run = runs[i % runCount];
+            fft.transformColumns(grids[i / runCount], run.first, run.second, workspace.scratch<Scalar>(worker));
+        });
+    } else {
+        int columnBatches = fft.columnBatches();
+        pool.parallelFor(gridCount * columnBatches, workers, [&](int i, int worker) {
+            fft.transformColumnBatch(grids[i / columnBatches], i % columnBatches, workspace.scratch<Scalar>(worker));
+        });
     }
     
-    kissfft<double> fft(M*N, false);
-    fft.transform(h_tildes_in, h_tildes_out);
-    fft.transform(disp_x_in, disp_x_out);
-    fft.transform(disp_z_in, disp_z_out);
+    end_stage(stage_start, stages.fftColumns, "fftColumns");
+    
+    int rowBatches = fft.rowBatches();
+    pool.parallelFor(gridCount * rowBatches, workers, [&](int i, int worker) {
+        fft.transformRowBatch(grids[i / rowBatches], i % rowBatches, workspace.scratch<Scalar>(worker));
+    });
+    end_stage(stage_start, stages.fftRows, "fftRows");
+    
+    if (profile) {
+        profile->fftRowBackend = fft.rowTransform().backend();
+        profile->fftColumnBackend = fft.columnTransform().backend();
+        profile->fftRowFixed = fft.rowTransform().fixedLength();
+        profile->fftColumnFixed = fft.columnTransform().fixedLength();
+    }
+    workspace.setContents(key);
+}
+
+void tessendorf::simulate(oceanWorkspace& workspace, float* out, size_t stride, float* normals, float* jacobians)
+{
+    int workers = threadPool::resolveThreads(threads);
+    bool derivatives = normals || jacobians;
+    
+    // The thread time of the parallel loops and the growth of the workspace go to the profile.
+    threadPool::usage* outer = profile ? threadPool::setUsage(&profile->threadTime) : NULL;
+    size_t held = workspace.bytes();
+    if (fieldPrecision == PRECISION_DOUBLE) {
+        transform_fields<double>(workspace, workers, derivatives);
+    } else {
+        transform_fields<float>(workspace, workers, derivatives);
+    }
+    if (profile && workspace.bytes() > held) {
+        profile->bytesAllocated += workspace.bytes() - held;
+    }
+    std::chrono::steady_clock::time_point stage_start = std::chrono::steady_clock::now();
+    
+    if (fieldPrecision == PRECISION_DOUBLE) {
+        assemble_points<double>(workspace, workers, out, stride, normals, jacobians);
+    } else {
+        assemble_points<float>(workspace, workers, out, stride, normals, jacobians);
+    }
+    end_stage(stage_start, stages.assemble, "assemble");
+    
+    if (profile) {
+        threadPool::setUsage(outer);
+    }
+}
+
+template <typename Scalar>
+void tessendorf::assemble_points(oceanWorkspace& workspace, int workers, float* out, size_t stride, float* normals, float* jacobians)
+{
+    bool derivatives = normals || jacobians;
     
-    double signs[2] = { -1., 1. };
+    // The real results now overwrite the spectra, with a row stride of fft.realStride() scalars.
+    const Scalar* heights = reinterpret_cast<const Scalar*>(workspace.spectrum<Scalar>(oceanWorkspace::HEIGHT));
+    const Scalar* x_disps = reinterpret_cast<const Scalar*>(workspace.spectrum<Scalar>(oceanWorkspace::DISP_X));
+    const Scalar* z_disps = reinterpret_cast<const Scalar*>(workspace.spectrum<Scalar>(oceanWorkspace::DISP_Z));
+    const Scalar* x_slopes = reinterpret_cast<const Scalar*>(workspace.spectrum<Scalar>(oceanWorkspace::SLOPE_X));
+    const Scalar* z_slopes = reinterpret_cast<const Scalar*>(workspace.spectrum<Scalar>(oceanWorkspace::SLOPE_Z));
+    const Scalar* xx_disps = reinterpret_cast<const Scalar*>(workspace.spectrum<Scalar>(oceanWorkspace::DISP_XX));
+    const Scalar* zz_disps = reinterpret_cast<const Scalar*>(workspace.spectrum<Scalar>(oceanWorkspace::DISP_ZZ));
+    const Scalar* xz_disps = reinterpret_cast<const Scalar*>(workspace.spectrum<Scalar>(oceanWorkspace::DISP_XZ));
+    int realStride = workspace.fft<Scalar>().realStride();
+    Scalar lambda_s = (Scalar)lambda;
     
-    for (int m = 0; m < M; m++) {
+    threadPool::shared().parallelFor(M, workers, [&](int m, int) {
+        int m_ = m - M / 2;  // m coord offsetted.
+        int row = m_ < 0 ? m_ + M : m_; // The grid is periodic, so negative positions wrap around.
+        
         for (int n = 0; n < N; n++) {
-            int index = m * N + n;
-            int sign = signs[(m + n) & 1]; // Sign-flip all of the odd coefficients.
-            
-            int m_ = m - M / 2;  // m coord offsetted.
             int n_ = n - N / 2;  // n coord offsetted.
+            int index = row * realStride + (n_ < 0 ? n_ + N : n_);
+            
+            float* point = out + (size_t)(m * N + n) * stride;
+            point[0] = n_ * Lx / N + x_disps[index] * lambda;
+            point[1] = heights[index];
+            point[2] = m_ * Lz / M + z_disps[index] * lambda;
+            
+            if (!derivatives) {
+                continue;
+            }
             
-            MFloatVector x(n_ * Lx / N + real(disp_x_out[index]) * lambda * sign,
-                           real(h_tildes_out[index]) * sign,
-                           m_ * Lz / M + real(disp_z_out[index]) * lambda * sign);
-            vertices.append(x);
+            // The surface is S(x, z) = (x + lambda Dx, h, z + lambda Dz); its tangents are dS/dx and dS/dz.
+            Scalar dxx = 1 + lambda_s * xx_disps[index];
+            Scalar dzz = 1 + lambda_s * zz_disps[index];
+            Scalar dxz = lambda_s * xz_disps[index];
+            size_t i = (size_t)m * N + n;
+            
+            if (normals) {
+                // The normal is dS/dz x dS/dx.
+                Scalar ax = dxz,    ay = z_slopes[index],   az = dzz;
+                Scalar bx = dxx,    by = x_slopes[index],   bz = dxz;
+                Scalar nx = ay * bz - az * by;
+                Scalar ny = az * bx - ax * bz;
+                Scalar nz = ax * by - ay * bx;
+                Scalar length = std::sqrt(nx * nx + ny * ny + nz * nz);
+                Scalar scale = length > 0 ? 1 / length : 0;
+                normals[3 * i] = (float)(nx * scale);
+                normals[3 * i + 1] = (float)(ny * scale);
+                normals[3 * i + 2] = (float)(nz * scale);
+            }
+            
+            if (jacobians) {
+                jacobians[i] = (float)(dxx * dzz - dxz * dxz);
+            }
         }
+    });
+}
+
+void tessendorf::simulateFields(oceanWorkspace& workspace, float* out, size_t stride)
+{
+    int workers = threadPool::resolveThreads(threads);
+    
+    // The thread time of the parallel loops and the growth of the workspace go to the profile.
+    threadPool::usage* outer = profile ? threadPool::setUsage(&profile->threadTime) : NULL;
+    size_t held = workspace.bytes();
+    if (fieldPrecision == PRECISION_DOUBLE) {
+        transform_fields<double>(workspace, workers);
+    } else {
+        transform_fields<float>(workspace, workers);
+    }
+    if (profile && workspace.bytes() > held) {
+        profile->bytesAllocated += workspace.bytes() - held;
     }
+    std::chrono::steady_clock::time_point stage_start = std::chrono::steady_clock::now();
     
-    delete [] h_tildes_in;
-    delete [] disp_x_in;
-    delete [] disp_z_in;
-    delete [] h_tildes_out;
-    delete [] disp_x_out;
-    delete [] disp_z_out;
+    if (fieldPrecision == PRECISION_DOUBLE) {
+        assemble_fields<double>(workspace, workers, out, stride);
+    } else {
+        assemble_fields<float>(workspace, workers, out, stride);
+    }
+    end_stage(stage_start, stages.assemble, "assemble");
     
-    return vertices;
+    if (profile) {
+        threadPool::setUsage(outer);
+    }
+}
+
+template <typename Scalar>
+void tessendorf::assemble_fields(oceanWorkspace& workspace, int workers, float* out, size_t stride)
+{
+    const Scalar* heights = reinterpret_cast<const Scalar*>(workspace.spectrum<Scalar>(oceanWorkspace::HEIGHT));
+    const Scalar* x_disps = reinterpret_cast<const Scalar*>(workspace.spectrum<Scalar>(oceanWorkspace::DISP_X));
+    const Scalar* z_disps = reinterpret_cast<const Scalar*>(workspace.spectrum<Scalar>(oceanWorkspace::DISP_Z));
+    int realStride = workspace.fft<Scalar>().realStride();
+    
+    threadPool::shared().parallelFor(M, workers, [&](int r, int) {
+        for (int c = 0; c < N; c++) {
+            int index = r * realStride + c;
+            float* sample = out + (size_t)(r * N + c) * stride;
+            sample[0] = x_disps[index] * lambda;
+            sample[1] = heights[index];
+            sample[2] = z_disps[index] * lambda;
+        }
+    });
 }
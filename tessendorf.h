@@ -9,42 +9,87 @@
 #ifndef __TessendorfOceanNode__tessendorf__
 #define __TessendorfOceanNode__tessendorf__
 
+#include <chrono>
 #include <complex>
-#include <maya/MPoint.h>
-#include <maya/MVector.h>
-#include <maya/MFloatPointArray.h>
+#include <vector>
+#include "oceanTypes.h"
+#include "spectrumCache.h"
+#include "oceanWorkspace.h"
+
+class oceanProfile;
 
 #define GRAVITY 9.8 // Acceleration due to gravity (m/s^2).
 
 typedef std::complex<double> complex;
+typedef std::complex<float> complexf;
 
 /**
  * A class that simulates ocean waves at a given time using Tessendorf's wave equations and the FFT method.
+ * The class has no dependency on the Maya SDK; the tessendorfOcean node adapts its output to Maya types.
  *
  * The equations referenced by the documentation comments are those in
  * "Simulating Ocean Waves", (c) 1999-2001 Jerry Tessendorf (SIGGRAPH Course Notes 2002).
  */
 class tessendorf {
-    double              T = 240.;                   /* Time of one phase of simulation (currently 4'0"). */
+    double              T = 240.;                   /* Time of one phase of simulation (4'0" unless set by setPeriod). */
     double              omega_0 = 2. * M_PI / T;    /* Dispersion-sub-naught; calculated using Tessendorf's equation (17). */
-    int                 M;                          /* Resolution of grid along X-axis (16 <= M <= 2048; where M = 2^x for integer x). */
-    int                 N;                          /* Resolution of grid along Z-axis (16 <= N <= 2048; where N = 2^z for integer z). */
+    int                 M;                          /* Resolution of grid along Z-axis (number of rows). */
+    int                 N;                          /* Resolution of grid along X-axis (number of columns; even). */
     double              Lx;                         /* Length of plane along X-axis (in m). */
     double              Lz;                         /* Length of plane along Z-axis (in m). */
     double              l;                          /* Size limit that waves must surpass to be rendered. */
     double              A;                          /* Controls height of Phillips spectrum. */
     double              V;                          /* Wind speed (in m/s). */
-    MVector             w_hat;                      /* Direction of wind. */
+    vector3             w_hat;                      /* Direction of wind. */
     double              lambda;                     /* Choppiness factor. */
     double              t;                          /* Time (in s). */
     int                 seed;                       /* Seed for the pseudorandom number generator. */
-    MFloatPointArray    vertices;
+    double              k_min;                      /* Wavevectors shorter than this are left out (see setBand). */
+    double              k_max;                      /* Wavevectors this long or longer are left out (see setBand). */
+    int                 threads;                    /* Number of threads to simulate with (< 1 for all hardware threads). */
+    bool                incremental;                /* Advance the phases of the last frame instead of evaluating them (see setIncremental). */
+    int                 requestedEvaluation;        /* Evaluation path to use (see setEvaluation). */
+    int                 fieldPrecision;             /* Scalar type of the grids and FFTs (see setPrecision). */
+    int                 lastPath;                   /* Evaluation path taken by the last simulation. */
+    size_t              lastActiveWaves;            /* Number of active waves in the last simulation. */
+    spectrumCache::entry spectrum;                  /* h~0(k) and conj(h~0(-k)) grids; shared across frames. */
     
     // Values precached on initialization.
     double              P_h__L;                     /* Precached for tessendorf::P_h. Largest possible waves arising from a continuous wind of speed V. */
     double              P_h__l_2;                   /* Precached for tessendorf::P_h. Square of l (l being the wave size limit). */
     
 public:
+    /**
+     * Ways to get from the spectrum to the real fields.
+     */
+    enum evaluation {
+        EVAL_AUTO = 0,      /* Pick the cheapest of the paths below (the default). */
+        EVAL_FULL_FFT,      /* Inverse FFTs over the whole grid. */
+        EVAL_PRUNED_FFT,    /* Inverse FFTs that skip the columns without active waves. */
+        EVAL_DIRECT_SUM,    /* Sum the active waves directly at every grid point. */
+        EVAL_REUSED         /* Only reported: the workspace already held the fields, so nothing was evaluated. */
+    };
+    
+    /**
+     * Scalar types for the grids, the inverse FFTs and the assembly of the output.
+     */
+    enum precision {
+        PRECISION_SINGLE = 0,   /* float: half the memory traffic, and SIMD FFT kernels (the default). */
+        PRECISION_DOUBLE        /* double: for reference bakes, and to measure the error of single precision. */
+    };
+    
+    /**
+     * Wall-clock time of each stage of a simulation (in ms).
+     */
+    struct stageTimes {
+        double          spectrum;       /* Initial spectrum: P_h and h~0 for every wave (on a cache miss only). */
+        double          waveTables;     /* Wavevector tables (when the plane size or period changed only). */
+        double          fill;           /* h~(k, t) and the displacement (and derivative) spectra. */
+        double          fftColumns;     /* Column pass of the inverse FFTs. */
+        double          fftRows;        /* Row pass of the inverse FFTs, or the whole direct sum. */
+        double          assemble;       /* Points (and normals and Jacobians) from the real fields. */
+    };
+    
     /**
      * Creates a new Tessendorf wave simulation at a specified time, given the specified parameters.
      * \param amplitude controls height of Phillips spectrum
@@ -52,48 +97,249 @@ public:
      * \param direction direction of wind
      * \param choppiness choppiness factor; greater is choppier
      * \param time time (in s)
-     * \param resX resolution of grid along X-axis (16 <= M <= 2048; where M = 2^x for integer x)
-     * \param resZ resolution of grid along Z-axis (16 <= N <= 2048; where N = 2^z for integer z)
+     * \param resX resolution of grid along X-axis; must be even, and is fastest as kissfftr2d::fastSize(resX)
+     * \param resZ resolution of grid along Z-axis; fastest as kissfftr2d::fastSize(resZ)
      * \param scaleX length of plane along X-axis (in m)
      * \param scaleZ length of plane along Z-axis (in m)
      * \param waveSizeLimit size limit that waves must surpass to be rendered
      * \param rngSeed seed for the pseudorandom number generator
      */
-    tessendorf(double amplitude, double speed, MVector direction, double choppiness, double time, int resX, int resZ, double scaleX, double scaleZ, double waveSizeLimit, int rngSeed);
+    tessendorf(double amplitude, double speed, vector3 direction, double choppiness, double time, int resX, int resZ, double scaleX, double scaleZ, double waveSizeLimit, int rngSeed);
     
     ~tessendorf();
     
+    /**
+     * Sets the number of threads that simulate() may use. Values less than 1 (the default) use every hardware
+     * thread. The result of the simulation is identical for any thread count.
+     */
+    void                setThreadCount(int threadCount);
+    
+    /**
+     * Sets the period T after which the simulation repeats (240 s by default). Dispersion is quantized to
+     * multiples of omega_0 = 2 pi / T (equation (17)), so the surface at time t is exactly the surface at t mod T.
+     * A shorter period makes a smaller loop bake, at the cost of coarser dispersion for slow waves.
+     */
+    void                setPeriod(double period);
+    
+    /**
+     * Enables incremental phase evaluation for sequential frames. Every wave's phase advances by omega(k) dt from
+     * one frame to the next, so instead of calling sin and cos for every k, the workspace keeps the phasors
+     * e^(i omega(k) t) of the last frame and rotates them by e^(i omega(k) dt). The phasors are renormalized
+     * every few frames and evaluated afresh every so often, which keeps them within a few ULPs of direct
+     * evaluation. A frame that isn't one step after the workspace's last frame (a seek, or a change of step) is
+     * evaluated directly, so any order of frames gives correct results; only sequential playback is faster.
+     * Off by default, in which case every frame is bit-for-bit reproducible regardless of the frames before it.
+     */
+    void                setIncremental(bool enable) { incremental = enable; }
+    
+    /**
+     * Chooses how the fields are evaluated. When the spectrum is built, its active waves are found: the weakest
+     * waves are left out as long as together they hold no more than 1e-12 of the energy. A large wave size
+     * filter or a low wind speed can suppress most of the spectrum, and then the full FFTs mostly transform
+     * zeros. EVAL_AUTO (the default) estimates the cost of each path from the number of active waves and
+     * columns, and takes the cheapest. The full FFT still transforms every wave; the sparse paths agree with it
+     * to within single-precision rounding.
+     */
+    void                setEvaluation(evaluation path) { requestedEvaluation = path; }
+    
+    /**
+     * Chooses the scalar type of the grids, the inverse FFTs and the assembly. The initial spectrum and the wave
+     * tables are always double precision, and the output is always float, but in between single precision
+     * (the default) moves half the bytes per grid and lets the FFTs use the SIMD kernels. Double precision is
+     * for reference bakes: it takes twice the workspace memory and up to three times as long, and the heights
+     * of single precision differ from it by a few parts in 10^7 of the peak height.
+     */
+    void                setPrecision(precision scalar) { fieldPrecision = scalar; }
+    
+    /** The precision set by setPrecision. */
+    precision           fieldsPrecision() const { return (precision)fieldPrecision; }
+    
+    /** A name for a precision, for logging. */
+    static const char*  precisionName(precision scalar);
+    
+    /** The evaluation path taken by the last simulate() or simulateFields(). */
+    evaluation          lastEvaluation() const { return (evaluation)lastPath; }
+    
+    /** The number of active waves (within the band) in the last simulation that evaluated its fields. */
+    size_t              lastActiveWaveCount() const { return lastActiveWaves; }
+    
+    /**
+     * The wall-clock time (in ms) of each stage of the last simulate() or simulateFields(). Stages that were
+     * skipped, e.g. the spectrum when it was cached or everything but the assembly when the fields were
+     * reused, take 0.
+     */
+    const stageTimes&   lastStageTimes() const { return stages; }
+    
+    /**
+     * Records the stages and counters (memory, cache hits and thread utilization) of later simulations into
+     * `profile`, on top of what it already holds, or stops recording if it is NULL (the default).
+     */
+    void                setProfile(oceanProfile* profile) { this->profile = profile; }
+    
+    /** A name for an evaluation path, for logging. */
+    static const char*  evaluationName(evaluation path);
+    
+    /** The period set by setPeriod. */
+    double              period() const { return T; }
+    
+    /**
+     * Restricts the simulation to the spectral band of wavevectors k with kMin <= |k| < kMax (in rad/m).
+     * By default every wavevector the grid can represent is simulated.
+     */
+    void                setBand(double kMin, double kMax);
+    
+    /**
+     * Creates cascade `index` (0 <= index < count) of a multi-cascade ocean based on this simulation.
+     *
+     * Cascade i covers a plane 1 / ratio^i the size of this one, with the same resolution, so each cascade adds
+     * detail ratio times finer than the one before. The cascades' bands don't overlap, so no part of the
+     * spectrum is counted twice when they are summed: each cascade takes the wavevectors beyond the Nyquist
+     * limit of the cascade before it (up to its own), and the last takes everything beyond. Each cascade also
+     * draws its own random numbers, and its amplitude is scaled by ratio^2i for its coarser wavevector spacing,
+     * so each band holds the energy it would have in one large grid. Cascade 0 of 1 is the same as this simulation.
+     */
+    tessendorf          cascade(int index, int count, double ratio) const;
+    
     /**
      * Generates the initial wave surface and performs Fast Fourier Transforms (FFTs) to calculate the displacement.
      * The main height displacement is based on the Fourier series in Tessendorf's equation (19).
      * The horizontal displacement is based on the Fourier series in equation (29).
+     *
+     * Normals and the Jacobian are computed analytically from the derivatives of the same Fourier series
+     * (multiplying h~ by i k), which costs five more inverse transforms, run in the same batches as the others.
+     *
+     * \param workspace buffers and FFT plans to use; resized if needed, and best kept alive across frames
+     * \param out receives the displaced grid positions, row-major; point i = m * N + n is written as three
+     *            floats (x, y, z) starting at out[i * stride]
+     * \param stride distance in floats between consecutive points (at least 3)
+     * \param normals if not NULL, receives the unit surface normal at point i as three floats starting at
+     *                normals[3 * i]
+     * \param jacobians if not NULL, receives the Jacobian determinant of the horizontal displacement at point i
+     *                  at jacobians[i]: 1 where the surface is undisturbed, less where it is squeezed together,
+     *                  and negative where it folds over itself (the usual foam mask)
+     */
+    void                simulate(oceanWorkspace& workspace, float* out, size_t stride = 3, float* normals = NULL, float* jacobians = NULL);
+    
+    /**
+     * Convenience form of simulate() that uses a temporary workspace and returns a new array of points.
      */
-    MFloatPointArray    simulate();
+    floatPointArray     simulate();
+    
+    /**
+     * Computes the displacement fields of the surface without assembling grid points. The fields are periodic,
+     * with sample (r, c) at rest position x = c * Lx / N, z = r * Lz / M (0 <= r < M, 0 <= c < N).
+     *
+     * \param workspace buffers and FFT plans to use; resized if needed
+     * \param out receives, for sample i = r * N + c, the x displacement (scaled by the choppiness), the height and
+     *            the z displacement (scaled by the choppiness) as three floats starting at out[i * stride]
+     * \param stride distance in floats between consecutive samples (at least 3)
+     */
+    void                simulateFields(oceanWorkspace& workspace, float* out, size_t stride = 3);
+    
+    /**
+     * Grid and plane dimensions. Grid rows run along the Z-axis and columns along the X-axis.
+     */
+    int                 rows() const { return M; }
+    int                 cols() const { return N; }
+    double              sizeX() const { return Lx; }
+    double              sizeZ() const { return Lz; }
+    double              bandMin() const { return k_min; }
+    double              bandMax() const { return k_max; }
     
 private:
+    stageTimes          stages;                     /* Stage times of the last simulation (see lastStageTimes). */
+    oceanProfile*       profile;                    /* Where the stages and counters are recorded (may be NULL). */
+    
+    /**
+     * Ends a stage that started at `since`: stores its time (in ms) in `stage`, records it in the profile, if
+     * any, and moves `since` to now, where the next stage starts.
+     */
+    void                end_stage(std::chrono::steady_clock::time_point& since, double& stage, const char* name);
+    
     /**
      * Gets the wave dispersion factor for a given vector k.
      * Calculated using Tessendorf's equations (14) and (18) combined.
      */
-    double              omega(MVector k);
+    double              omega(vector3 k);
     
     /**
      * Gets the value of the Phillips spectrum, which models wind-driven waves, for a given vector k.
      * Calculated using Tessendorf's equations (23) and (24) combined.
      */
-    double              P_h(MVector k);
+    double              P_h(vector3 k);
+    
+    /**
+     * Gets the value of h~-sub-naught for a given vector k, whose integer grid coordinates are (kx, kz).
+     * Calculated using Tessendorf's equation (25); the Gaussian draw depends only on the seed and (kx, kz).
+     */
+    complex             h_tilde_0(vector3 k, int kx, int kz);
+    
+    /**
+     * Gets the wavevector with integer grid coordinates (kx, kz), i.e. (2 pi kx / Lx, 0, 2 pi kz / Lz).
+     */
+    vector3             wave_vector(int kx, int kz);
+    
+    /**
+     * Gets the parameters that determine the initial spectrum.
+     */
+    spectrumParams      spectrum_params() const;
+    
+    /**
+     * Gets the initial spectrum (h~0(k) and conj(h~0(-k)) over the half plane of non-negative x-frequencies)
+     * for the current parameters.
+     * The spectrum does not depend on time or choppiness, so it is looked up in the spectrum cache and only
+     * generated on a miss.
+     */
+    spectrumCache::entry initial_spectrum();
+    
+    /**
+     * Generates the initial spectrum for the given parameters (those of this simulation) and finds its active waves.
+     */
+    spectrumCache::entry generate_spectrum(const spectrumParams& params);
+    
+    /**
+     * Lists the active waves of the current spectrum that lie within the band in the workspace's activeWaves(),
+     * and picks the evaluation path for them. Needs the wave tables.
+     */
+    evaluation          choose_evaluation(oceanWorkspace& workspace, int gridCount);
+    
+    /**
+     * Evaluates the fields by summing the waves at the given grid indices directly at every grid point, and
+     * writes them to the workspace's grids of Scalar in the layout of the inverse FFT's output.
+     */
+    template <typename Scalar>
+    void                direct_sum(oceanWorkspace& workspace, int workers, int gridCount, const std::vector<int>& active);
+    
+    /**
+     * Builds the workspace's wavevector tables (|k|, k^ and omega(k) for every grid index of the half plane)
+     * for the current plane size and period, unless they are already built.
+     */
+    void                wave_tables(oceanWorkspace& workspace, int workers);
+    
+    /**
+     * Fills the workspace's height and displacement spectra of Scalar for the current time and transforms them
+     * in place, leaving the real fields in the workspace with a row stride of workspace.fft<Scalar>().realStride()
+     * scalars. If `derivatives` is set, the slope and displacement derivative grids are filled and transformed too.
+     *
+     * The fields don't depend on choppiness, which is applied when they are assembled into points, so if the
+     * workspace still holds the fields of an earlier simulation with the same spectrum, band, phase time and
+     * precision (see oceanWorkspace::holds), nothing is recomputed.
+     */
+    template <typename Scalar>
+    void                transform_fields(oceanWorkspace& workspace, int workers, bool derivatives = false);
     
     /**
-     * Gets the value of h~-sub-naught for a given vector k at the current simulation time.
-     * Calculated using Tessendorf's equation (25).
+     * Assembles the points (and normals and Jacobians) of simulate() from the real fields of Scalar left in the
+     * workspace by transform_fields.
      */
-    complex             h_tilde_0(MVector k);
+    template <typename Scalar>
+    void                assemble_points(oceanWorkspace& workspace, int workers, float* out, size_t stride, float* normals, float* jacobians);
     
     /**
-     * Gets the value of h~ for a given vector k at the current simulation time.
-     * Calculated using Tessendorf's equation (26).
+     * Assembles the samples of simulateFields() from the real fields of Scalar left in the workspace.
      */
-    complex             h_tilde(MVector k);
+    template <typename Scalar>
+    void                assemble_fields(oceanWorkspace& workspace, int workers, float* out, size_t stride);
 };
 
 #endif /* defined(__TessendorfOceanNode__tessendorf__) */
@@ -0,0 +1,133 @@
+//
+//  tessendorfOceanDeformerNode.cpp
+//  TessendorfOceanNode
+//
+
+#include "tessendorfOceanDeformerNode.h"
+
+#include <maya/MItGeometry.h>
+#include <maya/MMatrix.h>
+#include <maya/MPoint.h>
+#include <maya/MPointArray.h>
+#include <maya/MDataBlock.h>
+#include <maya/MDataHandle.h>
+#include <maya/MFnEnumAttribute.h>
+#include <maya/MIOStream.h>
+
+#define MCheckErr(stat,msg)     \
+if (MS::kSuccess != stat) {	\
+cerr << msg;                    \
+return MS::kFailure;            \
+}
+
+oceanNodeAttributes tessendorfOceanDeformer::settings;
+MObject tessendorfOceanDeformer::filter;
+MTypeId tessendorfOceanDeformer::id(0x12347);
+
+void* tessendorfOceanDeformer::creator()
+{
+    return new tessendorfOceanDeformer;
+}
+
+MStatus tessendorfOceanDeformer::initialize()
+{
+    MFnEnumAttribute enumAttr;
+    
+    // Simulation settings
+    settings.create();
+    std::vector<MObject> inputs = settings.all();
+    for (size_t i = 0; i < inputs.size(); i++) {
+        addAttribute(inputs[i]);
+    }
+    
+    // Interpolation filter
+    filter = enumAttr.create("filter", "flt", oceanSampler::BICUBIC);
+    enumAttr.addField("Bilinear", oceanSampler::BILINEAR);
+    enumAttr.addField("Bicubic", oceanSampler::BICUBIC);
+    addAttribute(filter);
+    
+    inputs.push_back(filter);
+    for (size_t i = 0; i < inputs.size(); i++) {
+        attributeAffects(inputs[i], outputGeom);
+    }
+    
+    return MS::kSuccess;
+}
+
+MStatus tessendorfOceanDeformer::deform(MDataBlock& data, MItGeometry& iter, const MMatrix& localToWorld, unsigned int multiIndex)
+{
+    MStatus returnStatus;
+    
+    // Get the envelope attribute.
+    MDataHandle envelopeData = data.inputValue(envelope, &returnStatus);
+    MCheckErr(returnStatus, "ERROR getting envelope data handle\n");
+    float env = envelopeData.asFloat();
+    if (env == 0.f) {
+        return MS::kSuccess;
+    }
+    
+    oceanSettings ocean;
+    returnStatus = settings.read(data, ocean);
+    MCheckErr(returnStatus, "ERROR reading simulation settings\n");
+    
+    // Get the filter attribute.
+    MDataHandle filterData = data.inputValue(filter, &returnStatus);
+    MCheckErr(returnStatus, "ERROR getting filter data handle\n");
+    sampler.setFilter(filterData.asShort() == oceanSampler::BILINEAR ? oceanSampler::BILINEAR : oceanSampler::BICUBIC);
+    
+    // Points are treated as rest positions, like the vertices of the ocean grid, so no inversion is needed.
+    sampler.setIterations(0);
+    sampler.setThreadCount(ocean.threads);
+    
+    // Simulate the fields only when the frame or settings changed since the last evaluation.
+    if (!hasSampled || ocean != sampled) {
+        tessendorf simulation = ocean.simulation();
+        sampler.update(simulation, workspace, ocean.cascades, ocean.cascadeRatio);
+        sampled = ocean;
+        hasSampled = true;
+    }
+    
+    MPointArray points;
+    iter.allPositions(points);
+    unsigned int count = points.length();
+    if (count == 0) {
+        return MS::kSuccess;
+    }
+    
+    // Sample at world-space positions; the buffer holds the positions (3 floats each), the displacements (3 floats
+    // each) and the weights, in the iterator's order.
+    buffer.resize((size_t)count * 7);
+    float* positions = &buffer[0];
+    float* weights = positions + 6 * (size_t)count;
+    for (unsigned int i = 0; i < count; i++) {
+        MPoint world = points[i] * localToWorld;
+        positions[3 * i] = (float)world.x;
+        positions[3 * i + 1] = (float)world.y;
+        positions[3 * i + 2] = (float)world.z;
+    }
+    
+    unsigned int i = 0;
+    for (iter.reset(); !iter.isDone() && i < count; iter.next(), i++) {
+        weights[i] = env * weightValue(data, multiIndex, iter.index());
+    }
+    
+    oceanQuery q;
+    q.count = count;
+    q.positions = positions;
+    q.displacements = positions + 3 * (size_t)count;
+    sampler.query(q);
+    
+    // Move the points in world space, in double precision, and bring them back to local space.
+    MMatrix worldToLocal = localToWorld.inverse();
+    for (i = 0; i < count; i++) {
+        float scale = weights[i];
+        MPoint world = points[i] * localToWorld;
+        world.x += scale * q.displacements[3 * i];
+        world.y += scale * q.displacements[3 * i + 1];
+        world.z += scale * q.displacements[3 * i + 2];
+        points[i] = world * worldToLocal;
+    }
+    
+    iter.setAllPositions(points);
+    return MS::kSuccess;
+}
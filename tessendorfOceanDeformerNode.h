@@ -0,0 +1,50 @@
+//
+//  tessendorfOceanDeformerNode.h
+//  TessendorfOceanNode
+//
+//  A Maya deformer that applies the ocean's displacement to arbitrary geometry, such as
+//  adaptive or camera-projected grids.
+//
+
+#ifndef __TessendorfOceanNode__tessendorfOceanDeformerNode__
+#define __TessendorfOceanNode__tessendorfOceanDeformerNode__
+
+#include <maya/MPxDeformerNode.h>
+#include <maya/MTypeId.h>
+
+#include <vector>
+#include "oceanNodeAttributes.h"
+#include "oceanSampler.h"
+#include "oceanWorkspace.h"
+
+/**
+ * Displaces every input point by the ocean's displacement at the point's world-space (x, z) position, as if the
+ * point were a vertex of the simulated grid: heights are added along Y and, with choppiness, points also move
+ * sideways. Takes the same simulation settings as the tessendorfOcean node; connect them from it to keep the
+ * geometry in step with the ocean mesh.
+ *
+ * The displacement fields are simulated once per frame and reused for every deformed geometry and every
+ * evaluation with the same settings. Points are sampled in parallel by oceanSampler.
+ */
+class tessendorfOceanDeformer : public MPxDeformerNode
+{
+public:
+    tessendorfOceanDeformer() : hasSampled(false) {};
+    virtual         ~tessendorfOceanDeformer() {};
+    virtual MStatus deform(MDataBlock& data, MItGeometry& iter, const MMatrix& localToWorld, unsigned int multiIndex);
+    static  void*   creator();
+    static  MStatus initialize();
+    
+    static oceanNodeAttributes settings;    /** Simulation settings. */
+    static MObject  filter;         /** enum attribute; bilinear or bicubic interpolation. */
+    static MTypeId  id;
+    
+private:
+    oceanWorkspace      workspace;      /* FFT plans and buffers, kept between evaluations. */
+    oceanSampler        sampler;        /* Fields of the last simulated frame. */
+    oceanSettings       sampled;        /* Settings the sampler's fields were simulated with. */
+    bool                hasSampled;     /* Whether the sampler holds any fields yet. */
+    std::vector<float>  buffer;         /* World-space positions, then their displacements, then the point weights. */
+};
+
+#endif /* defined(__TessendorfOceanNode__tessendorfOceanDeformerNode__) */
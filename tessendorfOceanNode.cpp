@@ -25,6 +25,8 @@
 #include <maya/MFloatPointArray.h>
 #include <maya/MIntArray.h>
 #include <maya/MDoubleArray.h>
+#include <maya/MVectorArray.h>
+#include <maya/MColorArray.h>
 #include <maya/MFnNumericAttribute.h>
 #include <maya/MFnUnitAttribute.h>
 #include <maya/MFnTypedAttribute.h>
@@ -40,6 +42,16 @@
 #include <maya/MIOStream.h>
 
 #include "tessendorf.h"
+#include "oceanWorkspace.h"
+#include "oceanBake.h"
+#include "oceanMesh.h"
+#include "oceanProfile.h"
+#include "kissfft_wisdom.hh"
+#include "tessendorfOceanQueryNode.h"
+#include "tessendorfOceanDeformerNode.h"
+
+#include <string>
+#include <vector>
 
 #define MCheckErr(stat,msg)     \
 if (MS::kSuccess != stat) {	\
@@ -60,7 +72,9 @@ public:
     static  MStatus initialize();
     
     static MObject  time;           /** MTime attribute; the time passed in the simulation. */
-    static MObject  resolution;     /** int attribute; the number of vertices per row or column. */
+    static MObject  resolution;     /** int attribute; the number of vertices per row or column, as a power of 2. */
+    static MObject  resolutionX;    /** int attribute; the number of vertices along X, overriding resolution if not 0. */
+    static MObject  resolutionZ;    /** int attribute; the number of vertices along Z, overriding resolution if not 0. */
     static MObject  planeSize;      /** int attribute; the length or width of the ocean plane. */
     static MObject  waveSizeFilter; /** double attribute; waves smaller than this size are hidden. */
     static MObject  amplitude;      /** double attribute; determines the height of the waves. */
@@ -68,15 +82,26 @@ public:
     static MObject  windDirection;  /** MVector attribute; the direction of the wave movement. */
     static MObject  choppiness;     /** double attribute; higher value is choppier. */
     static MObject  seed;           /** int attribute; seed for the pseudorandom number generator. */
+    static MObject  period;         /** double attribute; time after which the simulation repeats (in s). */
+    static MObject  threads;        /** int attribute; number of simulation threads (0 uses every hardware thread). */
+    static MObject  cacheFile;      /** string attribute; bake file to play back instead of simulating, if it matches. */
+    static MObject  normals;        /** bool attribute; write analytic normals to the mesh instead of letting Maya compute them. */
+    static MObject  foam;           /** bool attribute; write the Jacobian determinant to the "foam" color set. */
+    static MObject  incremental;    /** bool attribute; advance the wave phases from the previous frame during playback. */
+    static MObject  doublePrecision; /** bool attribute; simulate in double instead of single precision, e.g. for reference bakes. */
+    static MObject  traceFile;      /** string attribute; Chrome trace file that each evaluation's stages are streamed to. */
     static MObject  outputMesh;
+    static MObject  stats;          /** string attribute (read-only); stage times and counters of the last evaluation, as JSON. */
     static MTypeId  id;
     
 protected:
     /**
-     * Generates an output mesh given the specified wave simulation parameters.
+     * Generates an output mesh given the specified wave simulation parameters. The mesh data is kept, and while
+     * its topology and per-vertex data stay the same, later calls only update its points.
      *
      * \param time the time passed in the simulation
-     * \param vertexResolution the number of vertices per row or column
+     * \param vertexResolutionX the number of vertices along the X-axis (even)
+     * \param vertexResolutionZ the number of vertices along the Z-axis
      * \param planeSize the length or width of the ocean plane
      * \param waveSizeFilter waves smaller than this size are hidden
      * \param amplitude determines the height of the waves
@@ -84,11 +109,18 @@ protected:
      * \param windDirection the direction of the wave movement
      * \param choppiness higher value is choppier
      * \param seed seed for the pseudorandom number generator
-     * \param the object reference to the output mesh data
-     * \return the output mesh
+     * \param period time after which the simulation repeats (in s)
+     * \param threads number of simulation threads (0 uses every hardware thread)
+     * \param cacheFile bake file to read the frame from, if it was baked with these parameters (may be empty)
+     * \param normals whether to write analytic normals to the mesh (simulated even when the points are baked)
+     * \param foam whether to write the Jacobian determinant to the "foam" color set (likewise)
+     * \param incremental whether to advance the wave phases from the previous frame (see tessendorf::setIncremental)
+     * \param doublePrecision whether to simulate in double precision (see tessendorf::setPrecision)
+     * \return the output mesh data, or a null object on failure
      */
     MObject createMesh(const MTime& time,
-                       const int vertexResolution,
+                       const int vertexResolutionX,
+                       const int vertexResolutionZ,
                        const double planeSize,
                        const double waveSizeFilter,
                        const double amplitude,
@@ -96,12 +128,51 @@ protected:
                        const MAngle& windDirection,
                        const double choppiness,
                        const int seed,
-                       MObject& outData,
+                       const double period,
+                       const int threads,
+                       const MString& cacheFile,
+                       const bool normals,
+                       const bool foam,
+                       const bool incremental,
+                       const bool doublePrecision,
                        MStatus& stat);
+    
+    /**
+     * Looks up a frame in the bake file.
+     *
+     * \param cacheFile path of the bake file; empty to not use one
+     * \param params the parameters the frame must have been baked with
+     * \param seconds the time of the frame
+     * \return the frame's packed (x, y, z) points, or NULL if it isn't baked
+     */
+    const float* bakedFrame(const MString& cacheFile, const oceanBakeParams& params, double seconds);
+    
+    /**
+     * Appends the profile of the last evaluation to the trace file, opening it first if it changed.
+     *
+     * \param traceFile path of the trace file; empty to not write one
+     */
+    void writeTrace(const MString& traceFile);
+    
+private:
+    oceanWorkspace      workspace;      /* FFT plans, buffers and the last frame's fields, kept between evaluations. */
+    oceanMesh           mesh;           /* Topology of the grid and the simulated normals and Jacobians. */
+    MIntArray           faceDegrees;    /* Copies of the mesh topology for MFnMesh, refreshed when it changes. */
+    MIntArray           faceVertices;
+    MIntArray           vertexList;     /* 0, 1, ... for each vertex, for setting per-vertex data. */
+    MFloatPointArray    vertices;       /* The points, which the simulation writes straight into. */
+    oceanBakeReader     bake;           /* The mapped cacheFile, if any. */
+    std::string         warnedCacheFile; /* Last cacheFile warned about, so each problem is reported once. */
+    int                 loggedEvaluation = -1; /* Last evaluation path reported, so each change is reported once. */
+    oceanProfile        profile;        /* Stages and counters of the last evaluation. */
+    oceanTrace          trace;          /* The open traceFile, if any. */
+    std::string         warnedTraceFile; /* Last traceFile warned about, so each problem is reported once. */
 };
 
 MObject tessendorfOcean::time;
 MObject tessendorfOcean::resolution;
+MObject tessendorfOcean::resolutionX;
+MObject tessendorfOcean::resolutionZ;
 MObject tessendorfOcean::planeSize;
 MObject tessendorfOcean::waveSizeFilter;
 MObject tessendorfOcean::amplitude;
@@ -109,7 +180,16 @@ MObject tessendorfOcean::windSpeed;
 MObject tessendorfOcean::windDirection;
 MObject tessendorfOcean::choppiness;
 MObject tessendorfOcean::seed;
+MObject tessendorfOcean::period;
+MObject tessendorfOcean::threads;
+MObject tessendorfOcean::cacheFile;
+MObject tessendorfOcean::normals;
+MObject tessendorfOcean::foam;
+MObject tessendorfOcean::incremental;
+MObject tessendorfOcean::doublePrecision;
+MObject tessendorfOcean::traceFile;
 MObject tessendorfOcean::outputMesh;
+MObject tessendorfOcean::stats;
 MTypeId tessendorfOcean::id(0x12345);
 
 void* tessendorfOcean::creator()
@@ -133,6 +213,20 @@ MStatus tessendorfOcean::initialize()
     numAttr.setMax(11);
     addAttribute(tessendorfOcean::resolution);
     
+    // Resolution along each axis, for sizes between the powers of 2 and for rectangular grids (0 follows
+    // resolution). Rounded up to a size the FFT handles quickly, such as 768 or 1536 (see kissfftr2d::fastSize).
+    tessendorfOcean::resolutionX = numAttr.create("resolutionX", "rsx", MFnNumericData::kInt, 0);
+    numAttr.setMin(0);
+    numAttr.setSoftMax(2048);
+    numAttr.setMax(4096);
+    addAttribute(tessendorfOcean::resolutionX);
+    
+    tessendorfOcean::resolutionZ = numAttr.create("resolutionZ", "rsz", MFnNumericData::kInt, 0);
+    numAttr.setMin(0);
+    numAttr.setSoftMax(2048);
+    numAttr.setMax(4096);
+    addAttribute(tessendorfOcean::resolutionZ);
+    
     // Plane size
     tessendorfOcean::planeSize = numAttr.create("planeSize", "psz", MFnNumericData::kDouble, 100.);
     numAttr.setMin(10.);
@@ -173,26 +267,125 @@ MStatus tessendorfOcean::initialize()
     tessendorfOcean::seed = numAttr.create("seed", "seed", MFnNumericData::kInt, 1);
     addAttribute(tessendorfOcean::seed);
     
+    // Loop period (a whole number of frames lets one loop bake cover any frame)
+    tessendorfOcean::period = numAttr.create("period", "per", MFnNumericData::kDouble, 240.);
+    numAttr.setMin(1.);
+    numAttr.setSoftMax(600.);
+    addAttribute(tessendorfOcean::period);
+    
+    // Simulation threads (0 = all hardware threads). The result doesn't depend on it, so it affects nothing.
+    tessendorfOcean::threads = numAttr.create("threads", "thr", MFnNumericData::kInt, 0);
+    numAttr.setMin(0);
+    addAttribute(tessendorfOcean::threads);
+    
+    // Bake file to play back (written by oceanSim --bake)
+    tessendorfOcean::cacheFile = typedAttr.create("cacheFile", "cf", MFnData::kString);
+    addAttribute(tessendorfOcean::cacheFile);
+    
+    // Analytic normals
+    tessendorfOcean::normals = numAttr.create("analyticNormals", "anm", MFnNumericData::kBoolean, true);
+    addAttribute(tessendorfOcean::normals);
+    
+    // Foam color set (Jacobian of the horizontal displacement; below 0 where the surface folds)
+    tessendorfOcean::foam = numAttr.create("foam", "fom", MFnNumericData::kBoolean, false);
+    addAttribute(tessendorfOcean::foam);
+    
+    // Incremental phase evaluation for sequential playback
+    tessendorfOcean::incremental = numAttr.create("incremental", "inc", MFnNumericData::kBoolean, false);
+    addAttribute(tessendorfOcean::incremental);
+    
+    // Double-precision grids and FFTs, for reference bakes
+    tessendorfOcean::doublePrecision = numAttr.create("doublePrecision", "dbp", MFnNumericData::kBoolean, false);
+    addAttribute(tessendorfOcean::doublePrecision);
+    
+    // Chrome trace of every evaluation, for offline profiling
+    tessendorfOcean::traceFile = typedAttr.create("traceFile", "trf", MFnData::kString);
+    addAttribute(tessendorfOcean::traceFile);
+    
     // Output mesh
     tessendorfOcean::outputMesh = typedAttr.create("outputMesh", "out", MFnData::kMesh);
     typedAttr.setStorable(false);
     addAttribute(tessendorfOcean::outputMesh);
     
-    attributeAffects(tessendorfOcean::time, tessendorfOcean::outputMesh);
-    attributeAffects(tessendorfOcean::resolution, tessendorfOcean::outputMesh);
-    attributeAffects(tessendorfOcean::planeSize, tessendorfOcean::outputMesh);
-    attributeAffects(tessendorfOcean::waveSizeFilter, tessendorfOcean::outputMesh);
-    attributeAffects(tessendorfOcean::amplitude, tessendorfOcean::outputMesh);
-    attributeAffects(tessendorfOcean::windSpeed, tessendorfOcean::outputMesh);
-    attributeAffects(tessendorfOcean::windDirection, tessendorfOcean::outputMesh);
-    attributeAffects(tessendorfOcean::choppiness, tessendorfOcean::outputMesh);
-    attributeAffects(tessendorfOcean::seed, tessendorfOcean::outputMesh);
+    // Stats of the last evaluation (computed with the mesh)
+    tessendorfOcean::stats = typedAttr.create("stats", "sts", MFnData::kString);
+    typedAttr.setStorable(false);
+    typedAttr.setWritable(false);
+    addAttribute(tessendorfOcean::stats);
+    
+    MObject inputs[] = { tessendorfOcean::time, tessendorfOcean::resolution, tessendorfOcean::resolutionX,
+                         tessendorfOcean::resolutionZ, tessendorfOcean::planeSize, tessendorfOcean::waveSizeFilter,
+                         tessendorfOcean::amplitude, tessendorfOcean::windSpeed, tessendorfOcean::windDirection,
+                         tessendorfOcean::choppiness, tessendorfOcean::seed, tessendorfOcean::period,
+                         tessendorfOcean::cacheFile, tessendorfOcean::normals, tessendorfOcean::foam,
+                         tessendorfOcean::incremental, tessendorfOcean::doublePrecision };
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        attributeAffects(inputs[i], tessendorfOcean::outputMesh);
+        attributeAffects(inputs[i], tessendorfOcean::stats);
+    }
     
     return MS::kSuccess;
 }
 
+const float* tessendorfOcean::bakedFrame(const MString& cacheFile, const oceanBakeParams& params, double seconds)
+{
+    std::string path = cacheFile.asChar();
+    
+    if (path.empty()) {
+        bake.close();
+        return NULL;
+    }
+    
+    // Map the file on first use, and again whenever it is re-baked.
+    if (!bake.isOpen() || bake.path() != path || !bake.isCurrent()) {
+        if (!bake.open(path.c_str())) {
+            if (warnedCacheFile != path) {
+                MGlobal::displayWarning(MString("tessendorfOcean: can't read bake file ") + cacheFile + ", simulating instead");
+                warnedCacheFile = path;
+            }
+            return NULL;
+        }
+    }
+    
+    if (bake.header().params != params) {
+        if (warnedCacheFile != path) {
+            MGlobal::displayWarning(MString("tessendorfOcean: ") + cacheFile + " was baked with different settings, simulating instead");
+            warnedCacheFile = path;
+        }
+        return NULL;
+    }
+    
+    warnedCacheFile.clear();
+    int index = bake.frameIndex(seconds);
+    return index < 0 ? NULL : bake.frame(index);
+}
+
+void tessendorfOcean::writeTrace(const MString& traceFile)
+{
+    std::string path = traceFile.asChar();
+    
+    if (path.empty()) {
+        trace.close();
+        return;
+    }
+    
+    if (!trace.isOpen() || trace.path() != path) {
+        if (!trace.open(path)) {
+            if (warnedTraceFile != path) {
+                MGlobal::displayWarning(MString("tessendorfOcean: can't create trace file ") + traceFile);
+                warnedTraceFile = path;
+            }
+            return;
+        }
+        warnedTraceFile.clear();
+    }
+    
+    trace.write(profile, "tessendorfOcean");
+}
+
 MObject tessendorfOcean::createMesh(const MTime& time,
-                                    const int vertexResolution /* Number of vertices per row/col. */,
+                                    const int vertexResolutionX /* Number of vertices per row. */,
+                                    const int vertexResolutionZ /* Number of vertices per column. */,
                                     const double planeSize,
                                     const double waveSizeFilter,
                                     const double amplitude,
@@ -200,71 +393,146 @@ MObject tessendorfOcean::createMesh(const MTime& time,
                                     const MAngle& windDirection,
                                     const double choppiness,
                                     const int seed,
-                                    MObject& outData,
+                                    const double period,
+                                    const int threads,
+                                    const MString& cacheFile,
+                                    const bool normals,
+                                    const bool foam,
+                                    const bool incremental,
+                                    const bool doublePrecision,
                                     MStatus& stat)
 {
-    int faceResolution = vertexResolution - 1; /* Number of faces per row/col. */
-    
-    MFloatPointArray vertices;
-    MIntArray faceDegrees;
-    MIntArray faceVertices;
-    int i, j;
+    // The topology only depends on the resolution; the Maya copies of it are refreshed when it changes.
+    size_t meshBytes = mesh.bytes();
+    oceanProfile::clock::time_point topologyStart = oceanProfile::clock::now();
+    if (mesh.resize(vertexResolutionX, vertexResolutionZ, threads, false) || faceDegrees.length() == 0) {
+        faceDegrees = MIntArray(mesh.faceDegrees(), mesh.faceCount());
+        faceVertices = MIntArray(mesh.faceVertices(), mesh.faceCount() * 4);
+        vertexList.setLength(mesh.vertexCount());
+        for (int i = 0; i < mesh.vertexCount(); ++i)
+        {
+            vertexList[i] = i;
+        }
+        vertices = MFloatPointArray(mesh.vertexCount()); // (0, 0, 0, 1); only x, y and z are written from here on.
+        profile.bytesAllocated += (size_t)mesh.vertexCount() * sizeof(MFloatPoint);
+        profile.record("topology", topologyStart, oceanProfile::clock::now());
+    }
+    int numVertices = mesh.vertexCount();
     
-    int numFaces = faceResolution * faceResolution;
+    // MFloatPointArray stores its points contiguously as (x, y, z, w) floats, so the simulation and the bake write
+    // straight into it with a stride of 4.
+    static_assert(sizeof(MFloatPoint) == 4 * sizeof(float), "MFloatPoint is expected to hold 4 packed floats");
+    float* points = &vertices[0].x;
     
     // Scale using the current time.
     double seconds = time.as(MTime::kSeconds);
     
     // Convert wind direction to a unit vector.
     double dirRadians = windDirection.asRadians();
-    MVector dirVector = MVector(cos(dirRadians), 0., sin(dirRadians));
-    
-    // tessendorf(double amplitude, double speed, MVector direction, double choppiness, double time, int resX, int resZ, double scaleX, double scaleZ, int rngSeed);
-    tessendorf simulation(amplitude, windSpeed, dirVector, choppiness, seconds, vertexResolution, vertexResolution, planeSize, planeSize, waveSizeFilter, seed);
-    MFloatPointArray simResult = simulation.simulate();
-    // Set up an array containing the vertex positions for the plane. The
-    // vertices are placed equi-distant on the X-Z plane to form a square
-    // grid that has a side length of "planeSize".
-    for (i = 0; i < vertexResolution; ++i)
-    {
-        for (j = 0; j < vertexResolution; ++j)
+    vector3 dirVector = vector3(cos(dirRadians), 0., sin(dirRadians));
+    
+    oceanBakeParams params = { amplitude, windSpeed, dirVector.x, dirVector.z, choppiness, planeSize, planeSize,
+                               waveSizeFilter, vertexResolutionX, vertexResolutionZ, seed,
+                               doublePrecision ? tessendorf::PRECISION_DOUBLE : tessendorf::PRECISION_SINGLE, period };
+    const float* baked = bakedFrame(cacheFile, params, seconds);
+    
+    // Bakes hold positions only, so when normals or foam are requested the frame is still simulated for them,
+    // and the baked positions then replace the simulated ones.
+    if (!baked || normals || foam) {
+        // tessendorf(double amplitude, double speed, vector3 direction, double choppiness, double time, int resX, int resZ, double scaleX, double scaleZ, int rngSeed);
+        tessendorf simulation(amplitude, windSpeed, dirVector, choppiness, seconds, vertexResolutionX, vertexResolutionZ, planeSize, planeSize, waveSizeFilter, seed);
+        simulation.setThreadCount(threads);
+        simulation.setPeriod(period);
+        simulation.setIncremental(incremental);
+        simulation.setPrecision(doublePrecision ? tessendorf::PRECISION_DOUBLE : tessendorf::PRECISION_SINGLE);
+        simulation.setProfile(&profile);
+        // The workspace keeps the fields of the last evaluation, so if only the choppiness changed (e.g. while
+        // its slider is dragged) the spectrum and the FFTs are skipped and the points are just rescaled.
+        oceanScopedTimer timer(&profile, "simulate");
+        simulation.simulate(workspace, points, 4, normals ? mesh.normals() : NULL, foam ? mesh.jacobians() : NULL);
+        
+        tessendorf::evaluation path = simulation.lastEvaluation();
+        if (path != tessendorf::EVAL_REUSED && path != loggedEvaluation) {
+            MString message("tessendorfOcean: evaluating the fields by ");
+            message += tessendorf::evaluationName(path);
+            message += " (";
+            message += (int)simulation.lastActiveWaveCount();
+            message += " active waves)";
+            MGlobal::displayInfo(message);
+            loggedEvaluation = path;
+        }
+    }
+    
+    if (baked) {
+        oceanScopedTimer timer(&profile, "bake");
+        for (int i = 0; i < numVertices; ++i)
         {
-            MFloatPoint disp = simResult[i * vertexResolution + j];
-            vertices.append(disp);
+            points[4 * i] = baked[3 * i];
+            points[4 * i + 1] = baked[3 * i + 1];
+            points[4 * i + 2] = baked[3 * i + 2];
         }
     }
     
-    // Set up an array containing the number of vertices
-    // for each of the plane's faces.
-    for (i = 0; i < numFaces; ++i)
-    {
-        faceDegrees.append(4); // Quads, so 4 vertices per face.
+    if (mesh.bytes() > meshBytes) {
+        profile.bytesAllocated += mesh.bytes() - meshBytes;
     }
     
-    // Set up an array to assign the vertices for each face.
-    for (i = 0; i < faceResolution; ++i)
+    // The vertices are placed on the X-Z plane around a square grid that has a side length of "planeSize",
+    // displaced by the waves. Every compute hands new mesh data to the output, since Maya may still hold the data
+    // of the last one; it is built from the cached topology and points, without rebuilding or copying either.
+    MObject meshData;
+    MFnMesh meshFn;
     {
-        for (j = 0; j < faceResolution; ++j)
+        oceanScopedTimer timer(&profile, "meshCreate");
+        MFnMeshData dataCreator;
+        meshData = dataCreator.create(&stat);
+        if (stat == MS::kSuccess) {
+            meshFn.create(numVertices, mesh.faceCount(), vertices, faceDegrees, faceVertices, meshData, &stat);
+        }
+        if (foam && stat == MS::kSuccess) {
+            meshFn.createColorSetWithName("foam");
+        }
+    }
+    if (stat != MS::kSuccess) {
+        return MObject();
+    }
+    
+    // Setting the normals locks them, so Maya uses them as they are instead of computing its own.
+    if (normals) {
+        oceanScopedTimer timer(&profile, "meshNormals");
+        const float* normalBuffer = mesh.normals();
+        MVectorArray vertexNormals(numVertices);
+        for (int i = 0; i < numVertices; ++i)
         {
-            faceVertices.append((i+1) * vertexResolution + j);
-            faceVertices.append((i+1) * vertexResolution + j + 1);
-            faceVertices.append(i * vertexResolution + j + 1);
-            faceVertices.append(i * vertexResolution + j);
+            vertexNormals.set(MVector(normalBuffer[3 * i], normalBuffer[3 * i + 1], normalBuffer[3 * i + 2]), i);
         }
+        stat = meshFn.setVertexNormals(vertexNormals, vertexList);
     }
     
-    MFnMesh meshFn;
-    MObject newMesh = meshFn.create(vertices.length(), numFaces, vertices,
-                                    faceDegrees, faceVertices, outData, &stat);
+    if (foam && stat == MS::kSuccess) {
+        oceanScopedTimer timer(&profile, "meshFoam");
+        const float* jacobianBuffer = mesh.jacobians();
+        MColorArray colors(numVertices);
+        for (int i = 0; i < numVertices; ++i)
+        {
+            colors.set(i, jacobianBuffer[i], jacobianBuffer[i], jacobianBuffer[i]);
+        }
+        meshFn.setCurrentColorSetName("foam");
+        stat = meshFn.setVertexColors(colors, vertexList, NULL, MFnMesh::kRGB);
+    }
     
-    return newMesh;
+    return meshData;
 }
 
 MStatus tessendorfOcean::compute(const MPlug& plug, MDataBlock& data)
 {
     MStatus returnStatus;
     
-    if (plug == outputMesh) {
+    if (plug == outputMesh || plug == stats) {
+        // The mesh and the stats are computed together; the stats cover everything from here on.
+        oceanProfile::clock::time_point computeStart = oceanProfile::clock::now();
+        profile.reset();
+        
         // Get the time attribute.
         MDataHandle timeData = data.inputValue(time, &returnStatus);
         MCheckErr(returnStatus, "ERROR getting time data handle\n");
@@ -275,6 +543,16 @@ MStatus tessendorfOcean::compute(const MPlug& plug, MDataBlock& data)
         MCheckErr(returnStatus, "ERROR getting resolution data handle\n");
         int res = pow(2, resData.asInt());
         
+        // Get the resolutionX and resolutionZ attributes. Sizes other than powers of 2 are rounded up to sizes
+        // that the FFT handles without its slow generic butterfly.
+        MDataHandle resXData = data.inputValue(resolutionX, &returnStatus);
+        MCheckErr(returnStatus, "ERROR getting resolutionX data handle\n");
+        int resX = resXData.asInt() > 0 ? kissfftr2d<float>::fastSize(resXData.asInt()) : res;
+        
+        MDataHandle resZData = data.inputValue(resolutionZ, &returnStatus);
+        MCheckErr(returnStatus, "ERROR getting resolutionZ data handle\n");
+        int resZ = resZData.asInt() > 0 ? kissfftr2d<float>::fastSize(resZData.asInt()) : res;
+        
         // Get the planeSize attribute.
         MDataHandle sizeData = data.inputValue(planeSize, &returnStatus);
         MCheckErr(returnStatus, "ERROR getting planeSize data handle\n");
@@ -310,19 +588,64 @@ MStatus tessendorfOcean::compute(const MPlug& plug, MDataBlock& data)
         MCheckErr(returnStatus, "ERROR getting seed data handle\n");
         int rngSeed = seedData.asInt();
         
+        // Get the period attribute.
+        MDataHandle periodData = data.inputValue(period, &returnStatus);
+        MCheckErr(returnStatus, "ERROR getting period data handle\n");
+        double loopPeriod = periodData.asDouble();
+        
+        // Get the threads attribute.
+        MDataHandle threadsData = data.inputValue(threads, &returnStatus);
+        MCheckErr(returnStatus, "ERROR getting threads data handle\n");
+        int threadCount = threadsData.asInt();
+        
+        // Get the cacheFile attribute.
+        MDataHandle cacheFileData = data.inputValue(cacheFile, &returnStatus);
+        MCheckErr(returnStatus, "ERROR getting cacheFile data handle\n");
+        MString bakePath = cacheFileData.asString();
+        
+        // Get the analyticNormals attribute.
+        MDataHandle normalsData = data.inputValue(normals, &returnStatus);
+        MCheckErr(returnStatus, "ERROR getting analyticNormals data handle\n");
+        bool writeNormals = normalsData.asBool();
+        
+        // Get the foam attribute.
+        MDataHandle foamData = data.inputValue(foam, &returnStatus);
+        MCheckErr(returnStatus, "ERROR getting foam data handle\n");
+        bool writeFoam = foamData.asBool();
+        
+        // Get the incremental attribute.
+        MDataHandle incrementalData = data.inputValue(incremental, &returnStatus);
+        MCheckErr(returnStatus, "ERROR getting incremental data handle\n");
+        bool advancePhases = incrementalData.asBool();
+        
+        // Get the doublePrecision attribute.
+        MDataHandle doublePrecisionData = data.inputValue(doublePrecision, &returnStatus);
+        MCheckErr(returnStatus, "ERROR getting doublePrecision data handle\n");
+        bool simulateDouble = doublePrecisionData.asBool();
+        
+        // Get the traceFile attribute.
+        MDataHandle traceFileData = data.inputValue(traceFile, &returnStatus);
+        MCheckErr(returnStatus, "ERROR getting traceFile data handle\n");
+        MString tracePath = traceFileData.asString();
+        
         // Get the output object attribute.
         MDataHandle outputHandle = data.outputValue(outputMesh, &returnStatus);
         MCheckErr(returnStatus, "ERROR getting polygon data handle\n");
         
-        MFnMeshData dataCreator;
-        MObject newOutputData = dataCreator.create(&returnStatus);
-        MCheckErr(returnStatus, "ERROR creating outputData");
+        MDataHandle statsHandle = data.outputValue(stats, &returnStatus);
+        MCheckErr(returnStatus, "ERROR getting stats data handle\n");
         
-        createMesh(time, res, size, wSize, amp, speed, dir, chop, rngSeed, newOutputData, returnStatus);
+        threadPool::usage* outerUsage = threadPool::setUsage(&profile.threadTime);
+        MObject outputData = createMesh(time, resX, resZ, size, wSize, amp, speed, dir, chop, rngSeed, loopPeriod, threadCount, bakePath, writeNormals, writeFoam, advancePhases, simulateDouble, returnStatus);
+        threadPool::setUsage(outerUsage);
         MCheckErr(returnStatus, "ERROR creating new tessendorfOcean");
         
-        outputHandle.set(newOutputData);
-        data.setClean(plug);
+        outputHandle.set(outputData);
+        profile.record("compute", computeStart, oceanProfile::clock::now());
+        statsHandle.set(MString(profile.json().c_str()));
+        writeTrace(tracePath);
+        data.setClean(outputMesh);
+        data.setClean(stats);
     } else
         return MS::kUnknownParameter;
     
@@ -334,6 +657,9 @@ MStatus initializePlugin(MObject obj)
     MStatus status;
     MFnPlugin plugin(obj, PLUGIN_COMPANY, "3.0", "Any");
     
+    // Each FFT length is tuned once, on first use, and the results are kept for later sessions.
+    kissfft_wisdom::enable(kissfft_wisdom::defaultPath());
+    
     status = plugin.registerNode("tessendorfOcean", tessendorfOcean::id,
                                  tessendorfOcean::creator, tessendorfOcean::initialize);
     if (!status) {
@@ -341,6 +667,21 @@ MStatus initializePlugin(MObject obj)
         return status;
     }
     
+    status = plugin.registerNode("tessendorfOceanQuery", tessendorfOceanQuery::id,
+                                 tessendorfOceanQuery::creator, tessendorfOceanQuery::initialize);
+    if (!status) {
+        status.perror("registerNode");
+        return status;
+    }
+    
+    status = plugin.registerNode("tessendorfOceanDeformer", tessendorfOceanDeformer::id,
+                                 tessendorfOceanDeformer::creator, tessendorfOceanDeformer::initialize,
+                                 MPxNode::kDeformerNode);
+    if (!status) {
+        status.perror("registerNode");
+        return status;
+    }
+    
     return status;
 }
 
@@ -349,6 +690,18 @@ MStatus uninitializePlugin(MObject obj)
     MStatus status;
     MFnPlugin plugin(obj);
     
+    status = plugin.deregisterNode(tessendorfOceanDeformer::id);
+    if (!status) {
+        status.perror("deregisterNode");
+        return status;
+    }
+    
+    status = plugin.deregisterNode(tessendorfOceanQuery::id);
+    if (!status) {
+        status.perror("deregisterNode");
+        return status;
+    }
+    
     status = plugin.deregisterNode(tessendorfOcean::id);
     if (!status) {
         status.perror("deregisterNode");
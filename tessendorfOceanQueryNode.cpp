@@ -0,0 +1,197 @@
+//
+//  tessendorfOceanQueryNode.cpp
+//  TessendorfOceanNode
+//
+
+#include "tessendorfOceanQueryNode.h"
+
+#include <maya/MPlug.h>
+#include <maya/MDataBlock.h>
+#include <maya/MDataHandle.h>
+#include <maya/MDoubleArray.h>
+#include <maya/MMatrix.h>
+#include <maya/MPoint.h>
+#include <maya/MVectorArray.h>
+#include <maya/MFnMatrixAttribute.h>
+#include <maya/MFnTypedAttribute.h>
+#include <maya/MFnNumericAttribute.h>
+#include <maya/MFnEnumAttribute.h>
+#include <maya/MFnDoubleArrayData.h>
+#include <maya/MFnVectorArrayData.h>
+#include <maya/MIOStream.h>
+
+#define MCheckErr(stat,msg)     \
+if (MS::kSuccess != stat) {	\
+cerr << msg;                    \
+return MS::kFailure;            \
+}
+
+oceanNodeAttributes tessendorfOceanQuery::settings;
+MObject tessendorfOceanQuery::positions;
+MObject tessendorfOceanQuery::inverseWorldMatrix;
+MObject tessendorfOceanQuery::filter;
+MObject tessendorfOceanQuery::iterations;
+MObject tessendorfOceanQuery::heights;
+MObject tessendorfOceanQuery::displacements;
+MObject tessendorfOceanQuery::normals;
+MTypeId tessendorfOceanQuery::id(0x12346);
+
+void* tessendorfOceanQuery::creator()
+{
+    return new tessendorfOceanQuery;
+}
+
+MStatus tessendorfOceanQuery::initialize()
+{
+    MFnTypedAttribute typedAttr;
+    MFnMatrixAttribute matrixAttr;
+    MFnNumericAttribute numAttr;
+    MFnEnumAttribute enumAttr;
+    
+    // Simulation settings
+    settings.create();
+    std::vector<MObject> inputs = settings.all();
+    for (size_t i = 0; i < inputs.size(); i++) {
+        addAttribute(inputs[i]);
+    }
+    
+    // Positions to sample
+    positions = typedAttr.create("positions", "pos", MFnData::kVectorArray);
+    addAttribute(positions);
+    
+    // Transform from world space to the ocean's space (identity by default)
+    inverseWorldMatrix = matrixAttr.create("inverseWorldMatrix", "iwm", MFnMatrixAttribute::kDouble);
+    addAttribute(inverseWorldMatrix);
+    
+    // Interpolation filter
+    filter = enumAttr.create("filter", "flt", oceanSampler::BICUBIC);
+    enumAttr.addField("Bilinear", oceanSampler::BILINEAR);
+    enumAttr.addField("Bicubic", oceanSampler::BICUBIC);
+    addAttribute(filter);
+    
+    // Iterations undoing the horizontal displacement
+    iterations = numAttr.create("iterations", "it", MFnNumericData::kInt, 3);
+    numAttr.setMin(0);
+    numAttr.setMax(10);
+    addAttribute(iterations);
+    
+    // Outputs
+    heights = typedAttr.create("heights", "hts", MFnData::kDoubleArray);
+    typedAttr.setStorable(false);
+    typedAttr.setWritable(false);
+    addAttribute(heights);
+    
+    displacements = typedAttr.create("displacements", "dsp", MFnData::kVectorArray);
+    typedAttr.setStorable(false);
+    typedAttr.setWritable(false);
+    addAttribute(displacements);
+    
+    normals = typedAttr.create("normals", "nrm", MFnData::kVectorArray);
+    typedAttr.setStorable(false);
+    typedAttr.setWritable(false);
+    addAttribute(normals);
+    
+    inputs.push_back(positions);
+    inputs.push_back(inverseWorldMatrix);
+    inputs.push_back(filter);
+    inputs.push_back(iterations);
+    for (size_t i = 0; i < inputs.size(); i++) {
+        attributeAffects(inputs[i], heights);
+        attributeAffects(inputs[i], displacements);
+        attributeAffects(inputs[i], normals);
+    }
+    
+    return MS::kSuccess;
+}
+
+MStatus tessendorfOceanQuery::compute(const MPlug& plug, MDataBlock& data)
+{
+    MStatus returnStatus;
+    
+    if (plug != heights && plug != displacements && plug != normals) {
+        return MS::kUnknownParameter;
+    }
+    
+    oceanSettings ocean;
+    returnStatus = settings.read(data, ocean);
+    MCheckErr(returnStatus, "ERROR reading simulation settings\n");
+    
+    // Get the positions attribute.
+    MDataHandle positionsData = data.inputValue(positions, &returnStatus);
+    MCheckErr(returnStatus, "ERROR getting positions data handle\n");
+    MVectorArray points = MFnVectorArrayData(positionsData.data()).array();
+    unsigned int count = points.length();
+    
+    // Get the inverseWorldMatrix attribute.
+    MDataHandle matrixData = data.inputValue(inverseWorldMatrix, &returnStatus);
+    MCheckErr(returnStatus, "ERROR getting inverseWorldMatrix data handle\n");
+    MMatrix worldToOcean = matrixData.asMatrix();
+    MMatrix oceanToWorld = worldToOcean.inverse();
+    
+    // Get the filter and iterations attributes.
+    MDataHandle filterData = data.inputValue(filter, &returnStatus);
+    MCheckErr(returnStatus, "ERROR getting filter data handle\n");
+    MDataHandle iterationsData = data.inputValue(iterations, &returnStatus);
+    MCheckErr(returnStatus, "ERROR getting iterations data handle\n");
+    
+    sampler.setFilter(filterData.asShort() == oceanSampler::BILINEAR ? oceanSampler::BILINEAR : oceanSampler::BICUBIC);
+    sampler.setIterations(iterationsData.asInt());
+    sampler.setThreadCount(ocean.threads);
+    
+    // Simulate the fields only when the frame or settings changed since the last evaluation, not when only the
+    // positions or the filter did.
+    if (!hasSampled || ocean != sampled) {
+        tessendorf simulation = ocean.simulation();
+        sampler.update(simulation, workspace, ocean.cascades, ocean.cascadeRatio);
+        sampled = ocean;
+        hasSampled = true;
+    }
+    
+    // One buffer holds the positions in the ocean's space (3 floats each), then heights (1), displacements (3) and
+    // normals (3).
+    buffer.resize((size_t)count * 10);
+    float* position = &buffer[0];
+    for (unsigned int i = 0; i < count; i++) {
+        MPoint local = MPoint(points[i].x, points[i].y, points[i].z) * worldToOcean;
+        position[3 * i] = (float)local.x;
+        position[3 * i + 1] = (float)local.y;
+        position[3 * i + 2] = (float)local.z;
+    }
+    
+    oceanQuery q;
+    q.count = count;
+    q.positions = position;
+    q.heights = position + 3 * (size_t)count;
+    q.displacements = q.heights + count;
+    q.normals = q.displacements + 3 * (size_t)count;
+    if (count > 0) {
+        sampler.query(q);
+    }
+    
+    // Bring the results back to world space. The surface point above a position lies on the same vertical line of
+    // the ocean's space, at the sampled height; normals transform by the inverse transpose.
+    MMatrix normalToWorld = worldToOcean.transpose();
+    MDoubleArray heightArray(count);
+    MVectorArray displacementArray(count);
+    MVectorArray normalArray(count);
+    for (unsigned int i = 0; i < count; i++) {
+        MPoint surface = MPoint(position[3 * i], q.heights[i], position[3 * i + 2]) * oceanToWorld;
+        heightArray[i] = surface.y;
+        displacementArray[i] = MVector(q.displacements[3 * i], q.displacements[3 * i + 1], q.displacements[3 * i + 2]) * oceanToWorld;
+        normalArray[i] = (MVector(q.normals[3 * i], q.normals[3 * i + 1], q.normals[3 * i + 2]) * normalToWorld).normal();
+    }
+    
+    // All three outputs come from the same query, so set them all.
+    MFnDoubleArrayData heightData;
+    data.outputValue(heights).set(heightData.create(heightArray));
+    MFnVectorArrayData displacementData;
+    data.outputValue(displacements).set(displacementData.create(displacementArray));
+    MFnVectorArrayData normalData;
+    data.outputValue(normals).set(normalData.create(normalArray));
+    
+    data.setClean(heights);
+    data.setClean(displacements);
+    data.setClean(normals);
+    
+    return MS::kSuccess;
+}
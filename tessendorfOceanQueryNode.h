@@ -0,0 +1,55 @@
+//
+//  tessendorfOceanQueryNode.h
+//  TessendorfOceanNode
+//
+//  A Maya node that answers point queries (height, displacement and normal) against the
+//  ocean, for buoyancy and particle effects that don't need the whole mesh.
+//
+
+#ifndef __TessendorfOceanNode__tessendorfOceanQueryNode__
+#define __TessendorfOceanNode__tessendorfOceanQueryNode__
+
+#include <maya/MPxNode.h>
+#include <maya/MTypeId.h>
+
+#include <vector>
+#include "oceanNodeAttributes.h"
+#include "oceanSampler.h"
+#include "oceanWorkspace.h"
+
+/**
+ * Samples the ocean at an array of positions. Takes the same simulation settings as the tessendorfOcean node
+ * (connect them from it to keep the two in step) and outputs, for every input position, the height of the
+ * surface above it, the displacement that carried a grid point there, and the surface normal.
+ *
+ * Positions and outputs are in world space. Connect the ocean transform's worldInverseMatrix to
+ * inverseWorldMatrix to place the ocean; the ocean repeats every planeSize along its X and Z axes.
+ */
+class tessendorfOceanQuery : public MPxNode
+{
+public:
+    tessendorfOceanQuery() : hasSampled(false) {};
+    virtual         ~tessendorfOceanQuery() {};
+    virtual MStatus compute(const MPlug& plug, MDataBlock& data);
+    static  void*   creator();
+    static  MStatus initialize();
+    
+    static oceanNodeAttributes settings;    /** Simulation settings. */
+    static MObject  positions;      /** vectorArray attribute; the world-space positions to sample. */
+    static MObject  inverseWorldMatrix; /** matrix attribute; from world space to the ocean's space. */
+    static MObject  filter;         /** enum attribute; bilinear or bicubic interpolation. */
+    static MObject  iterations;     /** int attribute; iterations used to undo the horizontal displacement. */
+    static MObject  heights;        /** doubleArray attribute; the world-space height (Y) of the surface point above each position. */
+    static MObject  displacements;  /** vectorArray attribute; the world-space displacement of the surface point above each position. */
+    static MObject  normals;        /** vectorArray attribute; the world-space surface normal above each position. */
+    static MTypeId  id;
+    
+private:
+    oceanWorkspace      workspace;  /* FFT plans and buffers, kept between evaluations. */
+    oceanSampler        sampler;    /* Fields of the last simulated frame. */
+    oceanSettings       sampled;    /* Settings the sampler's fields were simulated with. */
+    bool                hasSampled; /* Whether the sampler holds any fields yet. */
+    std::vector<float>  buffer;     /* Positions and results, converted to and from Maya's double arrays. */
+};
+
+#endif /* defined(__TessendorfOceanNode__tessendorfOceanQueryNode__) */
@@ -0,0 +1,174 @@
+//
+//  threadPool.cpp
+//  TessendorfOceanNode
+//
+
+#include "threadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+typedef std::chrono::steady_clock timer;
+
+static thread_local threadPool::usage* currentUsage = NULL; /* Usage sink of the loops this thread starts. */
+
+struct threadPool::job {
+    const body*             fn;
+    int                     count;
+    std::atomic<int>        next;       /* Next item to hand out. */
+    bool                    timed;      /* Whether the threads add their running time to busyNs. */
+    std::atomic<long long>  busyNs;     /* Time the threads spent running items (in ns). */
+    int                     slots;      /* Helper threads that may still join (guarded by the pool lock). */
+    int                     joined;     /* Helper threads that joined (guarded by the pool lock). */
+    int                     finished;   /* Helper threads that finished (guarded by the pool lock). */
+    std::condition_variable done;
+};
+
+threadPool& threadPool::shared()
+{
+    static threadPool pool;
+    return pool;
+}
+
+int threadPool::hardwareThreads()
+{
+    unsigned int n = std::thread::hardware_concurrency();
+    return n > 0 ? (int)n : 1;
+}
+
+int threadPool::resolveThreads(int threads)
+{
+    return threads < 1 ? hardwareThreads() : threads;
+}
+
+threadPool::usage* threadPool::setUsage(usage* sink)
+{
+    usage* previous = currentUsage;
+    currentUsage = sink;
+    return previous;
+}
+
+threadPool::~threadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+void threadPool::ensureWorkers(int count)
+{
+    // Called with the lock held.
+    while ((int)workers.size() < count) {
+        workers.push_back(std::thread(&threadPool::workerLoop, this));
+    }
+}
+
+void threadPool::runItems(job& j, int worker)
+{
+    timer::time_point start;
+    if (j.timed) {
+        start = timer::now();
+    }
+    
+    int i;
+    while ((i = j.next.fetch_add(1)) < j.count) {
+        (*j.fn)(i, worker);
+    }
+    
+    if (j.timed) {
+        j.busyNs += std::chrono::duration_cast<std::chrono::nanoseconds>(timer::now() - start).count();
+    }
+}
+
+void threadPool::workerLoop()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    
+    for (;;) {
+        wake.wait(guard, [this] { return stopping || !queue.empty(); });
+        if (stopping) {
+            return;
+        }
+        
+        job* j = queue.front();
+        int worker = ++j->joined;
+        if (--j->slots == 0) {
+            queue.pop_front();
+        }
+        
+        guard.unlock();
+        runItems(*j, worker);
+        guard.lock();
+        
+        j->finished++;
+        j->done.notify_all();
+    }
+}
+
+void threadPool::parallelFor(int count, int threads, const body& fn)
+{
+    if (count <= 0) {
+        return;
+    }
+    
+    // Nested loops run within this loop's busy time, so they aren't timed on their own.
+    usage* sink = setUsage(NULL);
+    timer::time_point start;
+    if (sink) {
+        start = timer::now();
+    }
+    
+    int helpers = std::min(resolveThreads(threads), count) - 1;
+    if (helpers <= 0) {
+        for (int i = 0; i < count; i++) {
+            fn(i, 0);
+        }
+        if (sink) {
+            double ms = std::chrono::duration<double, std::milli>(timer::now() - start).count();
+            sink->busy += ms;
+            sink->available += ms;
+        }
+        setUsage(sink);
+        return;
+    }
+    
+    job j;
+    j.fn = &fn;
+    j.count = count;
+    j.next = 0;
+    j.timed = sink != NULL;
+    j.busyNs = 0;
+    j.slots = helpers;
+    j.joined = 0;
+    j.finished = 0;
+    
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        ensureWorkers(helpers);
+        queue.push_back(&j);
+    }
+    wake.notify_all();
+    
+    runItems(j, 0);
+    
+    // Stop offering the job, then wait for the helpers that did pick it up.
+    std::unique_lock<std::mutex> guard(lock);
+    std::deque<job*>::iterator it = std::find(queue.begin(), queue.end(), &j);
+    if (it != queue.end()) {
+        queue.erase(it);
+    }
+    j.done.wait(guard, [&j] { return j.finished == j.joined; });
+    guard.unlock();
+    
+    if (sink) {
+        double ms = std::chrono::duration<double, std::milli>(timer::now() - start).count();
+        sink->busy += j.busyNs / 1e6;
+        sink->available += ms * (helpers + 1);
+    }
+    setUsage(sink);
+}
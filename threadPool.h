@@ -0,0 +1,90 @@
+//
+//  threadPool.h
+//  TessendorfOceanNode
+//
+//  A minimal pool of worker threads used to split the simulation into independent work items.
+//
+
+#ifndef __TessendorfOceanNode__threadPool__
+#define __TessendorfOceanNode__threadPool__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A pool of worker threads that run parallel loops.
+ *
+ * Every item of a loop is run exactly once, by exactly one thread, and items never share output, so the
+ * result of a loop does not depend on how many threads ran it or in what order the items were picked up.
+ * The calling thread always takes part in its own loop, so nested or concurrent loops cannot deadlock.
+ */
+class threadPool {
+public:
+    /**
+     * A loop body; called with the index of the item and the index (0 <= worker < threads) of the thread
+     * running it, so that callers can hand each thread its own scratch memory.
+     */
+    typedef std::function<void(int index, int worker)> body;
+    
+    /**
+     * Thread time of parallel loops (in ms): `busy` is the time threads spent running items, and `available` is
+     * the wall time of the loops times the threads they asked for, so busy / available is the thread utilization.
+     */
+    struct usage {
+        double          busy;
+        double          available;
+    };
+    
+    /**
+     * Gets the pool shared by all simulations in the process.
+     */
+    static threadPool&  shared();
+    
+    /**
+     * Gets the number of hardware threads (at least 1).
+     */
+    static int          hardwareThreads();
+    
+    /**
+     * Resolves a requested thread count: values less than 1 mean "all hardware threads".
+     */
+    static int          resolveThreads(int threads);
+    
+    /**
+     * Makes the loops that the calling thread starts add their thread time to `sink` (NULL to stop). Loops nested
+     * in the items of a timed loop are part of its busy time and are not added again.
+     * \return the previous sink of the calling thread
+     */
+    static usage*       setUsage(usage* sink);
+    
+    ~threadPool();
+    
+    /**
+     * Runs body(i, worker) for every i in [0, count), using at most `threads` threads (including the caller),
+     * and returns once every item has finished. The pool grows as needed to provide the requested threads.
+     */
+    void                parallelFor(int count, int threads, const body& fn);
+    
+private:
+    struct job;
+    
+    threadPool() : stopping(false) {}
+    threadPool(const threadPool&);
+    threadPool& operator=(const threadPool&);
+    
+    void                ensureWorkers(int count);
+    void                workerLoop();
+    static void         runItems(job& j, int worker);
+    
+    std::mutex                  lock;
+    std::condition_variable     wake;
+    std::deque<job*>            queue;
+    std::vector<std::thread>    workers;
+    bool                        stopping;
+};
+
+#endif /* defined(__TessendorfOceanNode__threadPool__) */